@@ -103,11 +103,14 @@
  * ram_stealmem can be used before ram_getsize is called to allocate
  * memory that cannot be freed later. This is intended for use early
  * in bootup before VM initialization is complete.
+ *
+ * ram_getavail returns how many bytes ram_stealmem can still hand out.
  */
 
 void ram_bootstrap(void);
 paddr_t ram_stealmem(unsigned long npages);
 paddr_t ram_getsize(void);
+paddr_t ram_getavail(void);
 paddr_t ram_getfirstfree(void);
 
 /*
@@ -116,11 +119,20 @@ paddr_t ram_getfirstfree(void);
  * We'll take up to 16 invalidations before just flushing the whole TLB.
  */
 
+struct addrspace;
+
+#define TS_VADDR	0	/* one page of ts_as */
+#define TS_RANGE	1	/* pages of ts_as in [ts_vaddr, ts_end) */
+#define TS_AS		2	/* all pages of ts_as */
+#define TS_FORGET	3	/* all pages of ts_as, which is being destroyed */
+#define TS_ALL		4	/* the whole TLB */
+
 struct tlbshootdown {
-	/*
-	 * Change this to what you need for your VM design.
-	 */
-	int ts_placeholder;
+	int ts_op;			/* one of the TS_* codes */
+	struct addrspace *ts_as;
+	vaddr_t ts_vaddr;		/* page to invalidate in ts_as */
+	vaddr_t ts_end;			/* end of the range for TS_RANGE */
+	volatile unsigned *ts_pending;	/* decremented once handled */
 };
 
 #define TLBSHOOTDOWN_MAX 16
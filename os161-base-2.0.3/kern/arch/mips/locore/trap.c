@@ -40,6 +40,9 @@
 #include <mainbus.h>
 #include <syscall.h>
 #include "opt-paging.h"
+#if OPT_PAGING
+#include <loadctl.h>
+#endif
 
 
 /* in exception-*.S */
@@ -322,6 +325,16 @@ mips_trap(struct trapframe *tf)
 	panic("I can't handle this... I think I'll just die now...\n");
 
  done:
+#if OPT_PAGING
+	/*
+	 * Returning to user mode from a syscall or a fault: this is the
+	 * safe point where the load control stops suspended processes.
+	 */
+	if (!iskern) {
+		loadctl_checkpoint();
+	}
+#endif
+
 	/*
 	 * Turn interrupts off on the processor, without affecting the
 	 * stored interrupt state.
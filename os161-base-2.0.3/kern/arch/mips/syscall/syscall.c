@@ -147,8 +147,25 @@ syscall(struct trapframe *tf)
 	    case SYS_fork:
 	        err = sys_fork(tf,&retval);
                 break;
+#if OPT_PAGING
+	    case SYS_vfork:
+	        err = sys_vfork(tf,&retval);
+                break;
+#endif
+#endif
+
 #endif
 
+#if OPT_PAGING
+	    case SYS_sbrk:
+	        err = sys_sbrk((intptr_t)tf->tf_a0, (vaddr_t *)&retval);
+                break;
+	    case SYS_getrusage:
+	        err = sys_getrusage((int)tf->tf_a0, (userptr_t)tf->tf_a1);
+                break;
+	    case SYS_execv:
+	        err = sys_execv((userptr_t)tf->tf_a0, (userptr_t)tf->tf_a1);
+                break;
 #endif
 
 	    default:
@@ -130,6 +130,15 @@ ram_getsize(void)
 	return lastpaddr;
 }
 
+/*
+ * Return how much memory is still available to ram_stealmem, in bytes.
+ */
+paddr_t
+ram_getavail(void)
+{
+	return lastpaddr - firstpaddr;
+}
+
 /*
  * This function is intended to be called by the VM system when it
  * initializes in order to find out what memory it has available to
@@ -36,6 +36,7 @@
 
 
 #include <vm.h>
+#include <spinlock.h>
 #include "opt-dumbvm.h"
 #include "opt-paging.h"
 #include <pt.h>
@@ -66,12 +67,89 @@ struct addrspace {
 #endif
 
 #if OPT_PAGING
+        /*
+         * Statistiche VM del processo (getrusage, comando vmtop del menu). I fault sono contati dal processo stesso;
+         * pagine residenti, pagine nello swapfile e swap out cambiano anche per le eviction fatte da altri processi,
+         * per questo sono aggiornate sotto stats_lock (as_stats_pages, as_stats_evicted).
+         */
+        struct as_stats {
+                unsigned int faults_tlb;   //tlb fault senza I/O: reload, software TLB, page cache
+                unsigned int faults_zero;  //pagine di stack e heap azzerate
+                unsigned int faults_elf;   //pagine lette dal file ELF
+                unsigned int faults_swap;  //pagine lette dallo swapfile (swap in)
+                unsigned int faults_cow;   //scritture su pagine copy-on-write
+                int resident;              //pagine in memoria (frame condivisi contati per ogni addrspace)
+                int resident_max;
+                int swapped;               //entry della page table che puntano a uno slot dello swapfile
+                unsigned int swapouts;     //pagine del processo scritte nello swapfile
+                int wss;                   //working set stimato (pagine), vedi vm_ws_sample
+                unsigned int pff;          //page-fault frequency: fault che hanno richiesto un frame al secondo
+        };
+
+/*
+ * Working set: pagine riferite negli ultimi WS_INTERVALS intervalli di WS_SAMPLE_TICKS tick (1 secondo).
+ */
+#define WS_SAMPLE_TICKS 10
+#define WS_INTERVALS    10
+
         struct addrspace {
                 struct pt* page_table;
                 struct vnode *vfile; //puntatore al ELF file del programmma
+                vaddr_t heap_end; //break corrente del processo (fine dell'heap, allineato alla pagina)
+                struct segment *last_seg; //ultimo segmento in cui è avvenuto un fault (cache per vm_fault)
+
+                //fault-around: ultimo fault e finestra [fa_lo, fa_hi) di pagine precaricate nella TLB
+                vaddr_t fa_last;
+                vaddr_t fa_lo;
+                vaddr_t fa_hi;
+                unsigned fa_count; //entry della finestra inserite davvero (tlb_preload salta quelle già presenti)
+
+                int prefault; //1 se load_elf ha caricato il programma subito invece che su richiesta
+
+                //serializza fault lenti, copy-on-write, sbrk e fork sulla page table (può dormire durante l'I/O)
+                struct lock *pt_lock;
+
+                //ASID delle entry nella TLB, sua generazione e CPU la cui TLB può contenerne (vm_tlb.c)
+                unsigned tlb_asid;
+                uint32_t tlb_gen;
+                uint32_t tlb_cpumask;
+
+                struct as_stats stats;
+                struct spinlock stats_lock;
+
+                //working set: intervallo corrente, tick del suo inizio e fault che hanno richiesto un frame in
+                //ciascuno degli ultimi intervalli (indice ws_epoch % (WS_INTERVALS + 1))
+                unsigned ws_epoch;
+                unsigned ws_tick;
+                unsigned ws_faults[WS_INTERVALS + 1];
         };
-        
+
+/*
+ * Fault-around: on a TLB reload, vm_fault also loads up to this many
+ * resident pages that follow (or precede) the faulting one in the same
+ * segment. 0 disables it. Can be changed from the kernel menu.
+ */
+#define FAULTAROUND_DEFAULT 4
+#define FAULTAROUND_MAX     16  /* well below NUM_TLB, see tlb_preload */
+
+/*
+ * Most pages vm_pin_range pins at once. Pinned frames cannot be
+ * evicted, so a larger range is refused instead of letting one caller
+ * lock down most of the coremap: pin big buffers a piece at a time.
+ */
+#define PIN_MAXPAGES        16
+
         void can_sleep(void);
+        void vm_set_faultaround(int npages);
+        void vm_set_cow(int enable);
+        void vm_ws_enable(int on);
+        int vm_ws_active(void);
+        int vm_pin_range(vaddr_t vaddr, size_t len, int write);
+        void vm_unpin_range(vaddr_t vaddr, size_t len);
+        int as_sbrk(struct addrspace *as, intptr_t amount, vaddr_t *oldbreak);
+        void as_stats_pages(struct addrspace *as, int resident, int swapped);
+        void as_stats_evicted(struct addrspace *as, int swapped);
+        void as_stats_get(struct addrspace *as, struct as_stats *st);
 #endif
 
 
@@ -113,6 +191,9 @@ struct addrspace {
  *                (Normally called *after* as_complete_load().) Hands
  *                back the initial stack pointer for the new process.
  *
+ *    as_sbrk   - move the break (end of the heap region) by AMOUNT
+ *                bytes and hand back the old one. Only with paging.
+ *
  * Note that when using dumbvm, addrspace.c is not used and these
  * functions are found in dumbvm.c.
  */
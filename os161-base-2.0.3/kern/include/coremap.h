@@ -3,6 +3,59 @@
 
 #include <addrspace.h>
 
+struct vnode;
+
+/*
+ * Reverse map: besides the (as, vaddr) kept in its coremap entry, a
+ * frame shared by several address spaces (code pages, COW after fork)
+ * has a list of the other mappings. The nodes come from a pool of
+ * RMAP_PER_FRAME * nframes entries allocated at boot and are linked
+ * by index; when the pool is empty the frame is simply not shared.
+ */
+#define RMAP_PER_FRAME 2
+
+struct rmap_entry {
+    struct addrspace *as;
+    vaddr_t vaddr;
+    int next; //indice del nodo successivo nel pool, -1 se ultimo
+};
+
+/*
+ * Page cache of read-only code pages, keyed by (ELF vnode, page of the
+ * code segment). Processes running the same executable map the same
+ * frame; the frame is released when its last mapping goes away.
+ */
+#define PCACHE_BUCKETS 64
+
+/*
+ * States of a user frame. A frame is BUSY_IN from allocation until its
+ * new owner has filled it (swapin, ELF read, zeroing or copy) and calls
+ * coremap_ready(); BUSY_OUT while, chosen as victim, it is written to
+ * swap without locks held. PINNED frames are held by the kernel (device
+ * I/O, copies) and, like busy ones, are never chosen as victims.
+ * Threads needing a busy frame sleep on its wait channel.
+ *
+ * The state, mappings and refcount of a user frame are protected by a
+ * frame lock; locks and wait channels are hashed by frame index,
+ * FRAME_LOCKS of each, so faults on different frames do not contend.
+ */
+#define FRAME_FREE     0
+#define FRAME_RESIDENT 1
+#define FRAME_BUSY_IN  2
+#define FRAME_BUSY_OUT 3
+#define FRAME_PINNED   4
+
+#define FRAME_LOCKS 32
+
+/*
+ * Pre-zeroed frames. When a CPU has nothing to run, the scheduler's
+ * idle loop zeroes free frames (coremap_prezero) and keeps them in a
+ * separate list, up to ZPOOL_MAX frames. Zero-fill faults take from
+ * it first (alloc_upage_zero); other allocations use it only when no
+ * other free frame is left.
+ */
+#define ZPOOL_MAX 32
+
 struct coremap_entry {
     bool occupied;       // Defines the state of the page 1=occupied  0=free
     bool freed;         //Indica se la entry è stata liberata (utile per la getfreepages) freed=1 è stata liberata freed=0 non è stata liberata (sarà occupata o untracked)
@@ -15,14 +68,47 @@ struct coremap_entry {
     //solo per User
     struct addrspace *as; //addrespace della pagina richiesta
     vaddr_t vaddr; //indirizzo d'inizio della pagina richiesta
+
+    int refcount; //numero di addrspace che mappano il frame (1 per le pagine private)
+    int rmap; //lista (indici nel pool) dei mapping oltre a (as, vaddr), -1 se il frame non è condiviso
+
+    //page cache: chiave (pc_vnode, pc_page) e catena della tabella hash. pc_vnode==NULL se il frame non è in cache
+    struct vnode *pc_vnode;
+    int pc_page;
+    int pc_next;
+
+    int state;    //FRAME_FREE, FRAME_RESIDENT, ... (solo frame user)
+    int pincount; //numero di coremap_pin ancora attivi, se state==FRAME_PINNED
+
+    //frame libero già azzerato (dal ciclo idle) e sua posizione nella lista dei frame liberi: quella dei frame
+    //azzerati se zeroed, altrimenti quella dei frame da azzerare
+    bool zeroed;
+    int fprev;
+    int fnext;
 };
 
 void coremap_init(void);
 void coremap_shutdown(void);
-void invalidVictim(void);
 vaddr_t alloc_kpages(size_t npages);
 void free_kpages(vaddr_t addr);
 paddr_t alloc_upage(vaddr_t vaddr);
+paddr_t alloc_upage_as(struct addrspace *as, vaddr_t vaddr);
+paddr_t alloc_upage_zero(vaddr_t vaddr, int *prezeroed);
+int coremap_prezero(void);
 void freeppage_user(paddr_t paddr);
+void coremap_release_batch(struct addrspace *as, struct entry **entries, int n);
+int coremap_freeframes(void);
+int coremap_share(paddr_t paddr, struct addrspace *as, vaddr_t vaddr);
+int coremap_unshare(paddr_t paddr, struct addrspace *as);
+int coremap_isshared(paddr_t paddr);
+paddr_t pagecache_lookup(struct vnode *v, int page, struct addrspace *as, vaddr_t vaddr);
+void pagecache_insert(paddr_t paddr, struct vnode *v, int page);
+void coremap_ready(paddr_t paddr);
+int coremap_isbusy(paddr_t paddr);
+void coremap_wait(paddr_t paddr);
+int coremap_pin(paddr_t paddr);
+void coremap_unpin(paddr_t paddr);
+void coremap_freeze(void);
+void coremap_thaw(void);
 
 #endif
\ No newline at end of file
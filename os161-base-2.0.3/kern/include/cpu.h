@@ -34,6 +34,8 @@
 #include <spinlock.h>
 #include <threadlist.h>
 #include <machine/vm.h>  /* for TLBSHOOTDOWN_MAX */
+#include <vmstats.h>     /* for VMSTATS_NUM, VMLAT_NUM */
+#include "opt-paging.h"
 
 
 /*
@@ -88,6 +90,32 @@ struct cpu {
 	unsigned c_numshootdown;
 	struct spinlock c_ipi_lock;
 
+#if OPT_PAGING
+	/*
+	 * VM statistics counters (see vmstats.h). Updated only by this
+	 * cpu, at splhigh and without locks; read by other cpus when
+	 * they are summed.
+	 */
+	unsigned c_vmstats[VMSTATS_NUM];
+
+	/* Latency histograms (see VMLAT_* in vmstats.h), same rules. */
+	unsigned c_vmlat[VMLAT_NUM][VMLAT_BUCKETS];
+	uint64_t c_vmlat_ns[VMLAT_NUM];
+	/*
+	 * 64-bit totals are two words on this cpu: readers on other
+	 * cpus retry while the sequence count is odd or has changed
+	 * (vmlat_record increments it before and after each update).
+	 */
+	volatile unsigned c_vmlat_seq;
+	/*
+	 * Reset generation the histograms belong to. vmlat_reset only
+	 * bumps the global one; this cpu clears its own histograms,
+	 * under c_vmlat_seq, on its next vmlat_record, and until then
+	 * readers count them as zero.
+	 */
+	unsigned c_vmlat_gen;
+#endif
+
 	/*
 	 * Accessed by other cpus. Protected inside hangman.c.
 	 */
@@ -155,6 +183,9 @@ void cpu_halt(void);
  * ipi_send sends an IPI to one CPU.
  * ipi_broadcast sends an IPI to all CPUs except the current one.
  * ipi_tlbshootdown is like ipi_send but carries TLB shootdown data.
+ * ipi_tlbshootdown_batch queues several shootdowns with a single IPI,
+ * waiting for the target to drain its queue if they don't fit; the
+ * caller must not hold spinlocks.
  *
  * interprocessor_interrupt is called on the target CPU when an IPI is
  * received.
@@ -169,6 +200,16 @@ void cpu_halt(void);
 void ipi_send(struct cpu *target, int code);
 void ipi_broadcast(int code);
 void ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping);
+void ipi_tlbshootdown_batch(struct cpu *target,
+			    const struct tlbshootdown *mappings, unsigned n);
+
+/*
+ * cpu_count returns the number of cpus; cpu_get returns the cpu whose
+ * c_number is N. For code that visits every cpu, e.g. to sum per-cpu
+ * counters.
+ */
+unsigned cpu_count(void);
+struct cpu *cpu_get(unsigned n);
 
 void interprocessor_interrupt(void);
 
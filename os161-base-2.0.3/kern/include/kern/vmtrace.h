@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009, 2014
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _KERN_VMTRACE_H_
+#define _KERN_VMTRACE_H_
+
+/*
+ * VM trace file format, written by the kernel (menu command
+ * "vmtrace dump") and read by the vmtrace decoder in userland/sbin.
+ * All fields are big-endian, like everything else on System/161.
+ *
+ * The file is a header followed by vh_nrecords fixed-size records.
+ * The records come in one run per CPU, each run in time order: sort
+ * by time to merge them.
+ */
+
+#define VMTRACE_MAGIC     0x564d5452    /* "VMTR" */
+#define VMTRACE_VERSION   1
+
+/* Event codes (vr_event) */
+#define VMT_FAULT_RELOAD  1   /* TLB fault on a resident page */
+#define VMT_FAULT_ZERO    2   /* page fault, zero-filled page */
+#define VMT_FAULT_ELF     3   /* page fault, page read from the ELF file */
+#define VMT_FAULT_SWAP    4   /* page fault, page read from swap slot vr_slot */
+#define VMT_FAULT_COW     5   /* write to a copy-on-write page */
+#define VMT_EVICT         6   /* frame vr_paddr taken from (vr_as, vr_vaddr),
+                                 written to swap slot vr_slot (-1: code page
+                                 dropped, it will be read again from the ELF) */
+
+struct vmtrace_header {
+	uint32_t vh_magic;      /* VMTRACE_MAGIC */
+	uint32_t vh_version;    /* VMTRACE_VERSION */
+	uint32_t vh_recsize;    /* sizeof(struct vmtrace_record) */
+	uint32_t vh_nrecords;   /* records following the header */
+	uint32_t vh_lost;       /* records overwritten before the dump */
+};
+
+struct vmtrace_record {
+	uint32_t vr_sec;        /* time of the event */
+	uint32_t vr_nsec;
+	uint8_t vr_event;       /* VMT_* */
+	uint8_t vr_cpu;         /* CPU that logged it */
+	uint16_t vr_unused;
+	int32_t vr_pid;         /* current process, -1 for none */
+	uint32_t vr_as;         /* address space (kernel address: joins
+	                           evictions to the faults of its owner) */
+	uint32_t vr_vaddr;      /* page */
+	uint32_t vr_paddr;      /* frame */
+	int32_t vr_slot;        /* swap slot, -1 for none */
+};
+
+#endif /* _KERN_VMTRACE_H_ */
@@ -0,0 +1,14 @@
+#ifndef _LOADCTL_H_
+#define _LOADCTL_H_
+
+#define LC_PERIOD        1  //secondi tra due controlli del carico
+#define LC_THRASH_PCT   50  //thrashing: percentuale del tempo delle CPU spesa a servire page fault...
+#define LC_MIN_FAULTS   20  //...con almeno questi page fault da disco nell'ultimo periodo
+#define LC_RECOVER_PCT  20  //sotto questa percentuale per LC_RECOVER_SECS controlli di fila si riammette un processo
+#define LC_RECOVER_SECS  2
+
+int loadctl_enable(int on);
+void loadctl_status(void);
+void loadctl_checkpoint(void);
+
+#endif
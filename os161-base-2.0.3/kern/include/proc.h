@@ -38,8 +38,10 @@
 
 #include <spinlock.h>
 #include "opt-waitpid.h"
+#include "opt-paging.h"
 
 struct addrspace;
+struct semaphore;
 struct thread;
 struct vnode;
 
@@ -78,6 +80,13 @@ struct proc {
 	/* VFS */
 	struct vnode *p_cwd;		/* current working directory */
 
+#if OPT_PAGING
+	/* vfork: parent waiting for exec/_exit; while set, p_addrspace is the parent's */
+	struct semaphore *p_vfork_sem;
+	/* load control: nonzero (order of suspension) while suspended */
+	unsigned p_suspended;
+#endif
+
 	/* add more material here as needed */
 #if OPT_WAITPID
         /* G.Cabodi - 2019 - implement waitpid: synchro, and exit status */
@@ -118,6 +127,19 @@ struct addrspace *proc_setas(struct addrspace *);
 
 /* wait for process termination, and return exit status */
 int proc_wait(struct proc *proc);
+
+#if OPT_PAGING
+/* A vfork child stops using the parent's address space; wakes the parent. */
+int proc_vfork_done(struct proc *proc);
+
+/* Print the VM statistics of all user processes (menu command vmtop). */
+void proc_vmtop(void);
+
+/* Load control: count, suspend and readmit user processes. */
+int proc_count_running(void);
+pid_t proc_suspend_largest(void);
+pid_t proc_readmit(void);
+#endif
 /* get proc from pid */
 struct proc *proc_search_pid(pid_t pid);
 
@@ -9,11 +9,14 @@ struct pt{
     struct segment* code;
     struct segment* data;
     struct segment* stack;
+    struct segment* heap; //cresce verso l'alto a partire dalla fine del segmento data (sbrk)
 };
 
 struct addrspace;
 
+struct segment* pt_get_segment(vaddr_t vaddr, struct addrspace *as);
 struct entry* get_pt_entry(vaddr_t vaddr, struct addrspace *as);
+void pt_check(struct addrspace *as);
 
 
 
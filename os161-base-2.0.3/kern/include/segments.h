@@ -9,6 +9,7 @@ struct entry{
     paddr_t paddr; //indirizzo fisico corrispondente a offset zero della pagina desiderata
     bool valid_bit; //indica se la pagina è in memoria oppure no
     int swapIndex; //Se è uguale a -1, allora vuol dire che lo swap della pagina non è avvenuto
+    unsigned ws_epoch; //intervallo del working set (as->ws_epoch) dell'ultimo riferimento, 0 se mai riferita
 };
 
 struct segment{
@@ -20,9 +21,20 @@ struct segment{
 
 };
 
+/*
+ * Executables whose loadable segments span at most PREFAULT_MAXPAGES
+ * pages in memory are loaded eagerly by load_elf() instead of being
+ * demand-paged, together with the top PREFAULT_STACKPAGES stack pages.
+ * This saves one ELF or zero-fill fault per page for short-lived tools.
+ */
+#define PREFAULT_MAXPAGES    16
+#define PREFAULT_STACKPAGES  1
+
 struct addrspace;
+struct vnode;
 
 int load_page(struct addrspace* as, int npage, paddr_t paddr, int segment);
+int load_segment_eager(struct addrspace *as, struct vnode *v, int segment, off_t offset, vaddr_t vaddr, size_t memsz, size_t filesz);
 
 
 #endif //_SEGMENTS_H_
\ No newline at end of file
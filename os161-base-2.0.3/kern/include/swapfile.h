@@ -8,7 +8,10 @@
 int swapfile_init(void);
 int swapout(paddr_t paddr );
 int swapin(int swapIndex, paddr_t paddr);
+void swap_share(int indexSwap);
 void swap_free(int indexSwap);
+void swap_free_batch(int *slots, int n);
+int swap_freeslots(void);
 void swap_shutdown(void);
 
 #endif 
\ No newline at end of file
@@ -34,6 +34,7 @@
 #include <cdefs.h> /* for __DEAD */
 #include "opt-syscalls.h"
 #include "opt-fork.h"
+#include "opt-paging.h"
 
 struct trapframe; /* from <machine/trapframe.h> */
 
@@ -69,8 +70,17 @@ int sys_waitpid(pid_t pid, userptr_t statusp, int options);
 pid_t sys_getpid(void);
 #if OPT_FORK
 int sys_fork(struct trapframe *ctf, pid_t *retval);
+#if OPT_PAGING
+int sys_vfork(struct trapframe *ctf, pid_t *retval);
+#endif
+#endif
+
 #endif
 
+#if OPT_PAGING
+int sys_sbrk(intptr_t amount, vaddr_t *retval);
+int sys_getrusage(int who, userptr_t usage);
+int sys_execv(userptr_t progname, userptr_t args);
 #endif
 
 #endif /* _SYSCALL_H_ */
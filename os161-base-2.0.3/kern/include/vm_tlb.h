@@ -2,9 +2,39 @@
 #define _VMTLB_H_
 
 #include <types.h>
+#include <vm.h>
+
+struct addrspace;
+
+#define TLB_MAXCPUS 32 //massimo numero di CPU di System/161
+
+/*
+ * Shootdown a batch: le traduzioni da invalidare vengono raccolte (anche con spinlock presi) e poi spedite con un
+ * solo IPI per CPU, senza lock, da tlb_shootdown_send, che ritorna quando tutte le CPU le hanno eseguite.
+ * Oltre TLBSHOOTDOWN_MAX traduzioni il batch diventa uno svuotamento completo delle TLB di destinazione.
+ */
+struct tlb_batch {
+    struct tlbshootdown ts[TLBSHOOTDOWN_MAX];
+    unsigned n;
+    uint32_t cpus;              //CPU di destinazione, un bit per c_number
+    volatile unsigned pending;  //invalidazioni non ancora eseguite
+};
 
 void tlb_insert(vaddr_t vaddr, paddr_t paddr, uint8_t readonly);
+int tlb_reload_soft(vaddr_t vaddr);
+void stlb_setup(void);
+int tlb_preload(vaddr_t vaddr, paddr_t paddr, uint8_t readonly);
+void tlb_update(vaddr_t vaddr, paddr_t paddr, uint8_t readonly);
 void tlb_invalid(void);
-void tlb_invalid_one(paddr_t paddr);
+int tlb_invalid_vaddr(vaddr_t vaddr);
+
+void tlb_activate(struct addrspace *as);
+void tlb_invalid_as(struct addrspace *as);
+void tlb_invalid_range(struct addrspace *as, vaddr_t start, vaddr_t end);
+void tlb_forget(struct addrspace *as);
+void tlb_batch_init(struct tlb_batch *b);
+void tlb_shootdown_add(struct tlb_batch *b, struct addrspace *as, vaddr_t vaddr);
+void tlb_shootdown_send(struct tlb_batch *b);
+void tlb_shootdown_handle(const struct tlbshootdown *ts);
 
-#endif
\ No newline at end of file
+#endif
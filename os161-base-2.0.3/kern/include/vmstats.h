@@ -2,36 +2,79 @@
 #define _VMSTATS_H_
 
 #include <types.h>
-#include <addrspace.h>
 
 #define TLB_FAULTS                  0 // The number of TLB misses that have occurred
 #define TLB_FAULTS_WITH_FREE        1 // The number of TLB misses for which there was free space in the TLB to add the new TLB entry 
 #define TLB_FAULTS_WITH_REPLACE     2 // The number of TLB misses for which there was no free space for the new TLB entry, 
                                         // so replacement was required.
-#define TLB_INVALIDATIONS           3 // The number of times the TLB was invalidated
+#define TLB_INVALIDATIONS           3 // The number of times the TLB (or all the entries of one address space) was invalidated
 #define TLB_RELOADS                 4 // The number of TLB misses for pages that were already in memory
 #define PAGE_FAULTS_ZEROED          5 // The number of TLB misses that required a new page to be zero-filled
 #define PAGE_FAULTS_DISK            6 // The number of TLB misses that required a page to be loaded from disk
 #define PAGE_FAULTS_ELF             7 // The number of page faults that require getting a page from the ELF file
 #define PAGE_FAULTS_SWAP            8 // The number of page faults that require getting a page from the swap file
 #define SWAPFILE_WRITES             9 // The number of page faults that require writing a page to the swap file
+#define TLB_PRELOADS               10 // The number of TLB entries loaded by fault-around for pages near a TLB miss
+#define TLB_PRELOADS_USED          11 // The number of preloaded entries that were used (estimated, see vm_faultaround_account)
+#define PAGES_PREFAULTED           12 // The number of pages loaded eagerly at exec time (no page fault taken)
+#define PAGECACHE_HITS             13 // The number of code pages mapped from the page cache instead of being read again
+#define COW_FAULTS                 14 // The number of writes to a copy-on-write page (not counted as TLB faults)
+#define COW_COPIES                 15 // The number of COW faults that had to copy the page (the frame was still shared)
+#define SWAP_FORK_SHARED           16 // The number of swapped-out pages forked by sharing the swap slot (no I/O)
+#define TLB_SHOOTDOWNS             17 // The number of TLB shootdown IPIs sent to other CPUs (one per CPU per batch)
+#define TLB_SHOOTDOWN_ENTRIES      18 // The number of TLB entries actually invalidated by received shootdowns
+#define ASID_ROLLOVERS             19 // The number of times the ASIDs ran out and a new generation started
+#define STLB_HITS                  20 // The number of TLB reloads served by the software TLB (no page table walk)
+#define PAGE_FAULTS_PREZEROED      21 // The number of zero-fill faults served by a frame zeroed in advance by the idle loop
 
+#define VMSTATS_NUM                22 // Number of counters above
+
+/*
+ * Latency histograms, one per event type below. The duration is measured in ns with the ltimer clock (accurate
+ * to one cycle) and counted in log2 buckets: bucket k holds the events that took [2^k, 2^(k+1)) ns.
+ * Like the counters above they live in each struct cpu (c_vmlat) and are updated without locks.
+ */
+#define VMLAT_FAULT_RELOAD          0 // vm_fault on a resident page (TLB reload, software TLB, page cache)
+#define VMLAT_FAULT_ZERO            1 // vm_fault that zero-filled a new page
+#define VMLAT_FAULT_ELF             2 // vm_fault that read the page from the ELF file
+#define VMLAT_FAULT_SWAP            3 // vm_fault that read the page from the swap file
+#define VMLAT_FAULT_COW             4 // write fault on a copy-on-write page
+#define VMLAT_SWAPIN                5 // swapin (read of one page from the swap file)
+#define VMLAT_SWAPOUT               6 // swapout (write of one page to the swap file)
+#define VMLAT_GETPPAGE              7 // getppage_user (frame allocation, eviction and swapout included)
+
+#define VMLAT_NUM                   8 // Number of histograms
+#define VMLAT_BUCKETS              32 // Buckets of each histogram (the last one also counts everything slower)
+
+/*
+ * The counters above live in each struct cpu (c_vmstats) and are updated by
+ * that cpu only, without locks; vmstats_get sums them. The statistics below
+ * are updated rarely and stay global, under vmstats_lock.
+ */
 struct statistics{
-    unsigned int tlb_faults;
-    unsigned int tlb_faults_with_free;
-    unsigned int tlb_faults_with_replace;
-    unsigned int tlb_invalidations;
-    unsigned int tlb_reloads;
-    unsigned int page_faults_zeroed;
-    unsigned int page_faults_disk;
-    unsigned int page_faults_elf;
-    unsigned int page_faults_swap;
-    unsigned int swapfile_writes;
+    unsigned int as_destroys;        // Number of address spaces torn down
+    uint64_t as_destroy_ns;          // Total time spent in as_destroy
+    uint64_t as_destroy_ns_max;      // Slowest as_destroy
+    unsigned int evictions;          // Number of victims picked (choice and TLB invalidation, swap I/O excluded)
+    uint64_t evict_ns;               // Total time spent picking victims and invalidating them in the TLBs
+    uint64_t evict_ns_max;           // Slowest of them
+    unsigned int shared_frames_peak; // Max number of frames mapped by more than one address space
+    unsigned int shared_pages_peak;  // Max number of pages saved by sharing (sum of refcount - 1)
 };
 
 void vmstats_init(void);
 void vmstats_increment(int code);
+void vmstats_add(int code, unsigned n);
+void vmstats_get(unsigned int *counters);
+void vmstats_shared(int frames, int pages);
+void vmstats_teardown(uint64_t ns);
+void vmstats_evict(uint64_t ns);
 void vmstats_shutdown(void);
+uint64_t vmlat_start(void);
+void vmlat_record(int code, uint64_t start);
+uint64_t vmlat_ns(int code);
+void vmlat_reset(void);
+void vmlat_print(void);
 
 
 
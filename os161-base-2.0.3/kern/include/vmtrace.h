@@ -0,0 +1,33 @@
+#ifndef _VMTRACE_H_
+#define _VMTRACE_H_
+
+#include <types.h>
+#include <kern/vmtrace.h>
+#include "opt-vmtrace.h"
+
+struct addrspace;
+
+#define VMTRACE_MAXCPUS 32   //massimo numero di CPU di System/161
+#define VMTRACE_RECS    2048 //record per CPU (64 KB): i più vecchi vengono sovrascritti
+
+#define VMTRACE_FILE "emu0:vmtrace.bin"
+
+/*
+ * Traccia degli eventi VM (formato in kern/vmtrace.h). Senza l'opzione vmtrace le chiamate VMTRACE spariscono;
+ * con l'opzione, finché la traccia non viene attivata dal menu costano un test di vmtrace_enabled.
+ */
+#if OPT_VMTRACE
+extern int vmtrace_enabled;
+
+#define VMTRACE(event, as, vaddr, paddr, slot) \
+    do { if (vmtrace_enabled) vmtrace_log(event, as, vaddr, paddr, slot); } while (0)
+
+void vmtrace_log(int event, struct addrspace *as, vaddr_t vaddr, paddr_t paddr, int slot);
+int vmtrace_start(void);
+void vmtrace_stop(void);
+int vmtrace_dump(const char *path);
+#else
+#define VMTRACE(event, as, vaddr, paddr, slot) ((void)0)
+#endif
+
+#endif
@@ -45,6 +45,14 @@
 #include <test.h>
 #include "opt-sfs.h"
 #include "opt-net.h"
+#include "opt-paging.h"
+
+#if OPT_PAGING
+#include <addrspace.h>
+#include <vmstats.h>
+#include <vmtrace.h>
+#include <loadctl.h>
+#endif
 
 /*
  * In-kernel menu and command dispatcher.
@@ -459,6 +467,240 @@ cmd_bootfs(int nargs, char **args)
 	return vfs_setbootfs(device);
 }
 
+#if OPT_PAGING
+/*
+ * Command for setting the fault-around window of the VM system.
+ */
+static
+int
+cmd_faultaround(int nargs, char **args)
+{
+	if (nargs != 2) {
+		kprintf("Usage: fa npages (0 disables, max %d)\n",
+			FAULTAROUND_MAX);
+		return EINVAL;
+	}
+
+	vm_set_faultaround(atoi(args[1]));
+
+	return 0;
+}
+
+/*
+ * Command for switching copy-on-write fork on and off, to compare
+ * e.g. "p /testbin/bigfork" and "p /testbin/forktest" both ways
+ * (time of the command and the sharing stats printed at shutdown).
+ */
+static
+int
+cmd_cow(int nargs, char **args)
+{
+	if (nargs != 2) {
+		kprintf("Usage: cow 0|1\n");
+		return EINVAL;
+	}
+
+	vm_set_cow(atoi(args[1]));
+
+	return 0;
+}
+
+/*
+ * Command for the VM latency histograms (vm_fault by type, swapin,
+ * swapout, getppage_user): prints them, or with "reset" clears them
+ * to measure one workload alone. They are also printed at shutdown.
+ */
+static
+int
+cmd_vmlat(int nargs, char **args)
+{
+	if (nargs == 1) {
+		vmlat_print();
+		return 0;
+	}
+	if (nargs == 2 && !strcmp(args[1], "reset")) {
+		vmlat_reset();
+		return 0;
+	}
+
+	kprintf("Usage: vmlat [reset]\n");
+	return EINVAL;
+}
+
+#if OPT_VMTRACE
+/*
+ * Command for the VM event trace: "on" starts it with empty buffers,
+ * "off" stops it, "dump [file]" writes the buffers to FILE (default
+ * VMTRACE_FILE, on the host through emu0). Decode the file on the
+ * host with hostbin/host-vmtrace.
+ */
+static
+int
+cmd_vmtrace(int nargs, char **args)
+{
+	int result;
+
+	if (nargs == 2 && !strcmp(args[1], "on")) {
+		return vmtrace_start();
+	}
+	if (nargs == 2 && !strcmp(args[1], "off")) {
+		vmtrace_stop();
+		return 0;
+	}
+	if ((nargs == 2 || nargs == 3) && !strcmp(args[1], "dump")) {
+		result = vmtrace_dump(nargs == 3 ? args[2] : VMTRACE_FILE);
+		if (result) {
+			kprintf("vmtrace: %s\n", strerror(result));
+		}
+		return result;
+	}
+
+	kprintf("Usage: vmtrace on|off|dump [file]\n");
+	return EINVAL;
+}
+#endif
+
+/*
+ * Top-like view of the VM usage of the running processes. With a
+ * COUNT the table of proc_vmtop is printed COUNT times, one second
+ * apart, by a kernel thread: the menu waits for the programs it runs,
+ * so e.g. "vmtop 10; p /testbin/matmult" watches matmult while it runs.
+ * The working set (WSS, PFF) is sampled only while such a thread or
+ * the load control runs, since sampling flushes the process's TLBs.
+ */
+static
+void
+cmd_vmtopthread(void *ptr, unsigned long count)
+{
+	unsigned long i;
+
+	(void)ptr;
+
+	/* WSS and PFF are sampled only while someone reads them */
+	vm_ws_enable(1);
+	for (i = 0; i < count; i++) {
+		clocksleep(1);
+		kprintf("\n");
+		proc_vmtop();
+	}
+	vm_ws_enable(0);
+}
+
+static
+int
+cmd_vmtop(int nargs, char **args)
+{
+	int count, result;
+
+	if (nargs > 2) {
+		kprintf("Usage: vmtop [count]\n");
+		return EINVAL;
+	}
+
+	if (nargs == 1) {
+		proc_vmtop();
+		return 0;
+	}
+
+	count = atoi(args[1]);
+	if (count <= 0) {
+		kprintf("Usage: vmtop [count]\n");
+		return EINVAL;
+	}
+
+	result = thread_fork("vmtop", NULL, cmd_vmtopthread, NULL, count);
+	if (result) {
+		kprintf("thread_fork failed: %s\n", strerror(result));
+		return result;
+	}
+
+	return 0;
+}
+
+/*
+ * Command for the load control against thrashing (vm/loadctl.c):
+ * "on" starts it, "off" stops it and readmits every suspended
+ * process; without arguments it prints its state.
+ */
+static
+int
+cmd_loadctl(int nargs, char **args)
+{
+	int result;
+
+	if (nargs == 1) {
+		loadctl_status();
+		return 0;
+	}
+	if (nargs == 2 && (!strcmp(args[1], "on") || !strcmp(args[1], "off"))) {
+		result = loadctl_enable(!strcmp(args[1], "on"));
+		if (result) {
+			kprintf("loadctl: %s\n", strerror(result));
+		}
+		return result;
+	}
+
+	kprintf("Usage: loadctl [on|off]\n");
+	return EINVAL;
+}
+
+/*
+ * Startup-latency benchmark: runs each program of /bin that needs no
+ * arguments RUNS times (default 5) and prints the average time from
+ * process creation to exit. Small binaries are loaded eagerly by
+ * load_elf (see PREFAULT_MAXPAGES), so compare with the vmstats
+ * "pages prefaulted" counter printed at shutdown.
+ */
+static
+int
+cmd_startbench(int nargs, char **args)
+{
+	static const char *progs[] = {
+		"/bin/true", "/bin/false", "/bin/pwd", "/bin/sync", "/bin/ls",
+		NULL
+	};
+	char progname[32];
+	char *pargs[2];
+	struct timespec before, after, duration;
+	uint64_t total;
+	int i, j, runs, result;
+
+	if (nargs > 2) {
+		kprintf("Usage: bst [runs]\n");
+		return EINVAL;
+	}
+	runs = (nargs == 2) ? atoi(args[1]) : 5;
+	if (runs <= 0) {
+		kprintf("bst: runs must be positive\n");
+		return EINVAL;
+	}
+
+	for (i=0; progs[i] != NULL; i++) {
+		total = 0;
+		for (j=0; j<runs; j++) {
+			/* common_prog waits for the program, so locals are safe */
+			strcpy(progname, progs[i]);
+			pargs[0] = progname;
+			pargs[1] = NULL;
+
+			gettime(&before);
+			result = common_prog(1, pargs);
+			gettime(&after);
+			if (result) {
+				return result;
+			}
+			timespec_sub(&after, &before, &duration);
+			total += duration.tv_sec * 1000000000ULL
+				+ duration.tv_nsec;
+		}
+		kprintf("%-12s %d runs, average %llu us\n", progs[i], runs,
+			(unsigned long long)(total / runs / 1000));
+	}
+
+	return 0;
+}
+#endif
+
 static
 int
 cmd_kheapstats(int nargs, char **args)
@@ -542,6 +784,17 @@ static const char *opsmenu[] = {
 	"[debug]   Drop to debugger          ",
 	"[panic]   Intentional panic         ",
 	"[deadlock] Intentional deadlock     ",
+#if OPT_PAGING
+	"[fa]      Set VM fault-around pages ",
+	"[bst]     Program startup benchmark ",
+	"[cow]     Copy-on-write fork on/off ",
+	"[vmtop]   VM usage of processes     ",
+	"[vmlat]   VM latency histograms     ",
+	"[loadctl] Thrashing load control    ",
+#if OPT_VMTRACE
+	"[vmtrace] VM event trace            ",
+#endif
+#endif
 	"[q]       Quit and shut down        ",
 	NULL
 };
@@ -650,6 +903,17 @@ static struct {
 	{ "debug",	cmd_debug },
 	{ "panic",	cmd_panic },
 	{ "deadlock",	cmd_deadlock },
+#if OPT_PAGING
+	{ "fa",		cmd_faultaround },
+	{ "bst",	cmd_startbench },
+	{ "cow",	cmd_cow },
+	{ "vmtop",	cmd_vmtop },
+	{ "vmlat",	cmd_vmlat },
+	{ "loadctl",	cmd_loadctl },
+#if OPT_VMTRACE
+	{ "vmtrace",	cmd_vmtrace },
+#endif
+#endif
 	{ "q",		cmd_quit },
 	{ "exit",	cmd_quit },
 	{ "halt",	cmd_quit },
@@ -178,6 +178,11 @@ proc_create(const char *name)
 	/* VFS fields */
 	proc->p_cwd = NULL;
 
+#if OPT_PAGING
+	proc->p_vfork_sem = NULL;
+	proc->p_suspended = 0;
+#endif
+
 	proc_init_waitpid(proc,name);
 
 	return proc;
@@ -257,16 +262,20 @@ proc_destroy(struct proc *proc)
 			as_deactivate();
 		}
 		else {
+			/* proc_vmtop may be reading it from the process table */
+			spinlock_acquire(&proc->p_lock);
 			as = proc->p_addrspace;
 			proc->p_addrspace = NULL;
+			spinlock_release(&proc->p_lock);
 		}
 		as_destroy(as);
 	}
 
 	KASSERT(proc->p_numthreads == 0);
-	spinlock_cleanup(&proc->p_lock);
 
+	/* out of the process table before p_lock goes away */
 	proc_end_waitpid(proc);
+	spinlock_cleanup(&proc->p_lock);
 
 	kfree(proc->p_name);
 	kfree(proc);
@@ -455,3 +464,195 @@ proc_wait(struct proc *proc)
 #endif
 }
 
+#if OPT_PAGING
+/*
+ * Called by a vfork child when it no longer needs the parent's
+ * address space (after execv has switched to a new one, or at
+ * _exit): wakes up the parent. Returns 1 if PROC was a vfork child
+ * still borrowing the address space, 0 otherwise.
+ */
+int
+proc_vfork_done(struct proc *proc)
+{
+	struct semaphore *sem;
+
+	spinlock_acquire(&proc->p_lock);
+	sem = proc->p_vfork_sem;
+	proc->p_vfork_sem = NULL;
+	spinlock_release(&proc->p_lock);
+
+	if (sem == NULL) {
+		return 0;
+	}
+	V(sem);
+	return 1;
+}
+
+/*
+ * Print the VM statistics (struct as_stats) of every process in the
+ * process table, one line per process. WSS is the estimated working
+ * set in pages and PFF the page faults per second over the same
+ * window (see vm_ws_sample). The rows are copied with the
+ * table locked and printed afterwards: p_lock keeps the address space
+ * from being destroyed while its counters are read.
+ */
+struct vmtop_row {
+  pid_t pid;
+  char name[16];
+  struct as_stats st;
+};
+
+void
+proc_vmtop(void)
+{
+#if OPT_WAITPID
+  struct vmtop_row *rows;
+  struct addrspace *as;
+  struct proc *p;
+  int i, n = 0;
+
+  rows = kmalloc(MAX_PROC * sizeof(struct vmtop_row));
+  if (rows == NULL) {
+    kprintf("vmtop: out of memory\n");
+    return;
+  }
+
+  spinlock_acquire(&processTable.lk);
+  for (i=1; i<=MAX_PROC && n<MAX_PROC; i++) {
+    p = processTable.proc[i];
+    if (p == NULL) continue;
+    spinlock_acquire(&p->p_lock);
+    as = p->p_addrspace;
+    if (as != NULL) {
+      rows[n].pid = p->p_pid;
+      snprintf(rows[n].name, sizeof(rows[n].name), "%s", p->p_name);
+      as_stats_get(as, &rows[n].st);
+      n++;
+    }
+    spinlock_release(&p->p_lock);
+  }
+  spinlock_release(&processTable.lk);
+
+  kprintf("  PID NAME             RES  SWAP  MAXRSS   WSS   PFF   RELOAD   ZERO    ELF SWAPIN    COW SWAPOUT\n");
+  for (i=0; i<n; i++) {
+    kprintf("%5d %-15s %5d %5d %6dk %5d %5u %8u %6u %6u %6u %6u %7u\n",
+            rows[i].pid, rows[i].name,
+            rows[i].st.resident, rows[i].st.swapped,
+            rows[i].st.resident_max * (PAGE_SIZE / 1024),
+            rows[i].st.wss, rows[i].st.pff,
+            rows[i].st.faults_tlb, rows[i].st.faults_zero,
+            rows[i].st.faults_elf, rows[i].st.faults_swap,
+            rows[i].st.faults_cow, rows[i].st.swapouts);
+  }
+  if (n == 0) {
+    kprintf("(no user processes)\n");
+  }
+  if (!vm_ws_active()) {
+    kprintf("(WSS and PFF not sampled: use \"vmtop count\" or \"loadctl on\")\n");
+  }
+
+  kfree(rows);
+#else
+  kprintf("vmtop: needs the process table (OPT_WAITPID)\n");
+#endif
+}
+
+/*
+ * Load control (vm/loadctl.c). A process is "running" if it has an
+ * address space, has not exited yet and is not suspended.
+ */
+#if OPT_WAITPID
+static unsigned proc_suspend_seq = 0;
+
+static int
+proc_isrunning(struct proc *p) {
+  return p->p_suspended == 0 && p->p_numthreads > 0 && p->p_addrspace != NULL;
+}
+#endif
+
+int
+proc_count_running(void)
+{
+  int n = 0;
+#if OPT_WAITPID
+  int i;
+
+  spinlock_acquire(&processTable.lk);
+  for (i=1; i<=MAX_PROC; i++) {
+    if (processTable.proc[i] != NULL && proc_isrunning(processTable.proc[i])) n++;
+  }
+  spinlock_release(&processTable.lk);
+#endif
+  return n;
+}
+
+/*
+ * Suspend the running process with the largest working set, unless
+ * it is the only one left. It stops at its next return to user mode
+ * (loadctl_checkpoint), holding no kernel locks, and its pages are
+ * then the first to go in the FIFO eviction since it no longer
+ * touches them. Returns its pid, 0 if none was suspended.
+ */
+pid_t
+proc_suspend_largest(void)
+{
+  pid_t pid = 0;
+#if OPT_WAITPID
+  struct proc *p, *victim = NULL;
+  struct as_stats st;
+  int i, running = 0, maxwss = -1;
+
+  spinlock_acquire(&processTable.lk);
+  for (i=1; i<=MAX_PROC; i++) {
+    p = processTable.proc[i];
+    if (p == NULL) continue;
+    spinlock_acquire(&p->p_lock);
+    if (proc_isrunning(p)) {
+      as_stats_get(p->p_addrspace, &st);
+      running++;
+      if (st.wss > maxwss) {
+        maxwss = st.wss;
+        victim = p;
+      }
+    }
+    spinlock_release(&p->p_lock);
+  }
+  if (victim != NULL && running > 1) {
+    victim->p_suspended = ++proc_suspend_seq;
+    pid = victim->p_pid;
+  }
+  spinlock_release(&processTable.lk);
+#endif
+  return pid;
+}
+
+/*
+ * Clear the suspension of the process suspended first. The caller
+ * wakes it up (loadctl.c, under the lock loadctl_checkpoint sleeps
+ * with). Returns its pid, 0 if no process is suspended.
+ */
+pid_t
+proc_readmit(void)
+{
+  pid_t pid = 0;
+#if OPT_WAITPID
+  struct proc *p, *first = NULL;
+  int i;
+
+  spinlock_acquire(&processTable.lk);
+  for (i=1; i<=MAX_PROC; i++) {
+    p = processTable.proc[i];
+    if (p != NULL && p->p_suspended != 0 &&
+        (first == NULL || p->p_suspended < first->p_suspended)) {
+      first = p;
+    }
+  }
+  if (first != NULL) {
+    first->p_suspended = 0;
+    pid = first->p_pid;
+  }
+  spinlock_release(&processTable.lk);
+#endif
+  return pid;
+}
+#endif
@@ -10,6 +10,10 @@
 #include <copyinout.h>
 #include <syscall.h>
 #include <lib.h>
+#include "opt-paging.h"
+#if OPT_PAGING
+#include <addrspace.h>
+#endif
 
 /*
  * simple file system calls for write/read
@@ -37,6 +41,9 @@ sys_read(int fd, userptr_t buf_ptr, size_t size)
 {
   int i;
   char *p = (char *)buf_ptr;
+#if OPT_PAGING
+  vaddr_t pinned = 0;
+#endif
 
   if (fd!=STDIN_FILENO) {
     kprintf("sys_read supported only to stdin\n");
@@ -44,10 +51,32 @@ sys_read(int fd, userptr_t buf_ptr, size_t size)
   }
 
   for (i=0; i<(int)size; i++) {
+#if OPT_PAGING
+    /*
+     * The process sleeps in getch: keep the page being filled in
+     * memory meanwhile. One page at a time, so that a large buffer
+     * cannot pin all the user frames.
+     */
+    if (((vaddr_t)&p[i] & PAGE_FRAME) != pinned) {
+      if (pinned != 0) {
+        vm_unpin_range(pinned, 1);
+      }
+      pinned = (vaddr_t)&p[i] & PAGE_FRAME;
+      if (vm_pin_range(pinned, 1, 1)) {
+        return i > 0 ? i : -1;
+      }
+    }
+#endif
     p[i] = getch();
     if (p[i] < 0) 
-      return i;
+      break;
   }
 
-  return (int)size;
+#if OPT_PAGING
+  if (pinned != 0) {
+    vm_unpin_range(pinned, 1);
+  }
+#endif
+
+  return i;
 }
@@ -164,6 +164,10 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 	struct iovec iov;
 	struct uio ku;
 	struct addrspace *as;
+#if OPT_PAGING
+	int nloads = 0;
+	size_t mempages = 0;
+#endif
 
 	as = proc_getas();
 
@@ -256,7 +260,50 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 		if (result) {
 			return result;
 		}
+
+		#if OPT_PAGING
+		nloads++;
+		mempages += ((ph.p_vaddr & ~(vaddr_t)PAGE_FRAME) + ph.p_memsz
+			     + PAGE_SIZE - 1) / PAGE_SIZE;
+		#endif
+	}
+
+	#if OPT_PAGING
+	/*
+	 * Small programs are loaded right away, one read per segment,
+	 * instead of taking one page fault per page. Larger ones
+	 * (or ones with a big bss) are left to demand paging.
+	 */
+	if (nloads <= 2 && mempages <= PREFAULT_MAXPAGES) {
+		int seg = 0;
+
+		for (i=0; i<eh.e_phnum; i++) {
+			off_t offset = eh.e_phoff + i*eh.e_phentsize;
+			uio_kinit(&iov, &ku, &ph, sizeof(ph), offset, UIO_READ);
+
+			result = VOP_READ(v, &ku);
+			if (result) {
+				return result;
+			}
+			if (ku.uio_resid != 0) {
+				kprintf("ELF: short read on phdr - file truncated?\n");
+				return ENOEXEC;
+			}
+			if (ph.p_type != PT_LOAD) {
+				continue;
+			}
+
+			result = load_segment_eager(as, v, seg, ph.p_offset,
+						    ph.p_vaddr, ph.p_memsz,
+						    ph.p_filesz);
+			if (result) {
+				return result;
+			}
+			seg++;
+		}
+		as->prefault = 1;
 	}
+	#endif
 
 	#if !OPT_PAGING
 	result = as_prepare_load(as);
@@ -18,6 +18,10 @@
 #include <mips/trapframe.h>
 #include <current.h>
 #include <synch.h>
+#include <limits.h>
+#include <spinlock.h>
+#include <vfs.h>
+#include <kern/fcntl.h>
 
 /*
  * system calls for process management
@@ -25,6 +29,13 @@
 void
 sys__exit(int status)
 {
+#if OPT_PAGING
+  if (curproc->p_vfork_sem != NULL) {
+    /* vfork child: the address space belongs to the parent */
+    proc_setas(NULL);
+    proc_vfork_done(curproc);
+  }
+#endif
 #if OPT_WAITPID
   struct proc *p = curproc;
   p->p_status = status & 0xff; /* just lower 8 bits returned */
@@ -134,4 +145,310 @@ int sys_fork(struct trapframe *ctf, pid_t *retval) {
 
   return 0;
 }
+
+#if OPT_PAGING
+/*
+ * vfork: the child runs in the parent's address space (no as_copy
+ * at all) and the parent sleeps until the child calls execv or
+ * _exit. Meant for fork+exec: the child must not return from the
+ * function that called vfork.
+ */
+int sys_vfork(struct trapframe *ctf, pid_t *retval) {
+  struct trapframe *tf_child;
+  struct semaphore *sem;
+  struct proc *newp;
+  int result;
+
+  KASSERT(curproc != NULL);
+
+  newp = proc_create_runprogram(curproc->p_name);
+  if (newp == NULL) {
+    return ENOMEM;
+  }
+
+  sem = sem_create("vfork", 0);
+  if (sem == NULL) {
+    proc_destroy(newp);
+    return ENOMEM;
+  }
+
+  tf_child = kmalloc(sizeof(struct trapframe));
+  if(tf_child == NULL){
+    sem_destroy(sem);
+    proc_destroy(newp);
+    return ENOMEM;
+  }
+  memcpy(tf_child, ctf, sizeof(struct trapframe));
+
+  /* borrowed until the child calls execv or _exit */
+  newp->p_addrspace = curproc->p_addrspace;
+  newp->p_vfork_sem = sem;
+
+  result = thread_fork(
+		 curthread->t_name, newp,
+		 call_enter_forked_process,
+		 (void *)tf_child, (unsigned long)0/*unused*/);
+
+  if (result){
+    newp->p_addrspace = NULL;
+    newp->p_vfork_sem = NULL;
+    proc_destroy(newp);
+    sem_destroy(sem);
+    kfree(tf_child);
+    return ENOMEM;
+  }
+
+  *retval = newp->p_pid;
+
+  /* the child may already be gone after this: use only the pid */
+  P(sem);
+  sem_destroy(sem);
+
+  return 0;
+}
+#endif
+#endif
+
+#if OPT_PAGING
+/*
+ * execv support. The program name and the arguments are staged in a
+ * single ARG_MAX kernel buffer: the name first, then the argument
+ * strings packed one after the other, then (while building the new
+ * stack) the user argv array. Buffers are kept in a small pool so
+ * that back-to-back execs do not go through kmalloc/kfree of 64K.
+ */
+#define EXECV_POOLSIZE 1
+
+static struct spinlock argbuf_lock = SPINLOCK_INITIALIZER;
+static char *argbuf_pool[EXECV_POOLSIZE];
+
+static char *
+argbuf_get(void)
+{
+  char *buf = NULL;
+  int i;
+
+  spinlock_acquire(&argbuf_lock);
+  for (i = 0; i < EXECV_POOLSIZE; i++) {
+    if (argbuf_pool[i] != NULL) {
+      buf = argbuf_pool[i];
+      argbuf_pool[i] = NULL;
+      break;
+    }
+  }
+  spinlock_release(&argbuf_lock);
+
+  if (buf == NULL) {
+    buf = kmalloc(ARG_MAX);
+  }
+  return buf;
+}
+
+static void
+argbuf_put(char *buf)
+{
+  int i;
+
+  spinlock_acquire(&argbuf_lock);
+  for (i = 0; i < EXECV_POOLSIZE; i++) {
+    if (argbuf_pool[i] == NULL) {
+      argbuf_pool[i] = buf;
+      buf = NULL;
+      break;
+    }
+  }
+  spinlock_release(&argbuf_lock);
+
+  if (buf != NULL) {
+    kfree(buf);
+  }
+}
+
+/*
+ * Copy program name and arguments into BUF. Each string is copied
+ * with one copyinstr straight to its final place. On success *ARGC
+ * is the number of arguments and *USED the bytes of BUF in use; the
+ * arguments start at BUF + *ARGSTART.
+ */
+static int
+execv_copyin(userptr_t progname, userptr_t args, char *buf,
+             int *argc, size_t *argstart, size_t *used)
+{
+  userptr_t uarg;
+  size_t len, pos;
+  int n, result;
+
+  result = copyinstr(progname, buf, PATH_MAX, &len);
+  if (result) {
+    return result;
+  }
+  if (len <= 1) {
+    return EINVAL;
+  }
+  pos = len;
+  *argstart = pos;
+
+  for (n = 0; ; n++) {
+    result = copyin(args + n * sizeof(userptr_t), &uarg, sizeof(userptr_t));
+    if (result) {
+      return result;
+    }
+    if (uarg == NULL) {
+      break;
+    }
+    /* leave room for the (aligned) argv array built by execv_copyout */
+    if (pos + (n + 3) * sizeof(userptr_t) >= ARG_MAX) {
+      return E2BIG;
+    }
+    result = copyinstr(uarg, buf + pos,
+                       ARG_MAX - pos - (n + 3) * sizeof(userptr_t), &len);
+    if (result == ENAMETOOLONG) {
+      return E2BIG;
+    }
+    if (result) {
+      return result;
+    }
+    pos += len;
+  }
+
+  *argc = n;
+  *used = pos;
+  return 0;
+}
+
+/*
+ * Build argv on the new user stack: the strings are copied out in one
+ * block, the pointer array (prepared in BUF after the strings) in
+ * another.
+ */
+static int
+execv_copyout(char *buf, int argc, size_t argstart, size_t used,
+              vaddr_t *stackptr, userptr_t *uargv)
+{
+  size_t strsize;
+  vaddr_t strbase, argvbase;
+  userptr_t *argv;
+  char *p;
+  int i, result;
+
+  strsize = used - argstart;
+  strbase = (*stackptr - strsize) & ~(vaddr_t)(sizeof(userptr_t) - 1);
+
+  argv = (userptr_t *)(buf + ((used + sizeof(userptr_t) - 1)
+                              & ~(sizeof(userptr_t) - 1)));
+  p = buf + argstart;
+  for (i = 0; i < argc; i++) {
+    argv[i] = (userptr_t)(strbase + (p - (buf + argstart)));
+    p += strlen(p) + 1;
+  }
+  argv[argc] = NULL;
+
+  argvbase = strbase - (argc + 1) * sizeof(userptr_t);
+  /* keep the stack pointer 8-byte aligned as the MIPS ABI wants */
+  argvbase &= ~(vaddr_t)7;
+
+  result = copyout(buf + argstart, (userptr_t)strbase, strsize);
+  if (result) {
+    return result;
+  }
+  result = copyout(argv, (userptr_t)argvbase,
+                   (argc + 1) * sizeof(userptr_t));
+  if (result) {
+    return result;
+  }
+
+  *stackptr = argvbase;
+  *uargv = (userptr_t)argvbase;
+  return 0;
+}
+
+/*
+ * execv: replace the current program. The new address space is only
+ * set up by load_elf (pages come in on demand, small binaries are
+ * loaded eagerly); the old one is destroyed right after the switch,
+ * so the process never holds two complete images.
+ */
+int
+sys_execv(userptr_t progname, userptr_t args)
+{
+  struct addrspace *oldas, *newas;
+  struct vnode *v;
+  vaddr_t entrypoint, stackptr;
+  userptr_t uargv;
+  size_t argstart, used;
+  char *buf;
+  int argc, result;
+
+  KASSERT(curproc != NULL);
+
+  buf = argbuf_get();
+  if (buf == NULL) {
+    return ENOMEM;
+  }
+
+  result = execv_copyin(progname, args, buf, &argc, &argstart, &used);
+  if (result) {
+    argbuf_put(buf);
+    return result;
+  }
+
+  /* vfs_open may modify the name, which is no longer needed after */
+  result = vfs_open(buf, O_RDONLY, 0, &v);
+  if (result) {
+    argbuf_put(buf);
+    return result;
+  }
+
+  newas = as_create();
+  if (newas == NULL) {
+    vfs_close(v);
+    argbuf_put(buf);
+    return ENOMEM;
+  }
+
+  /*
+   * From here the vnode belongs to newas and is closed by as_destroy,
+   * also on failure: only after the frames it keys in the page cache
+   * (eagerly loaded code pages) are released.
+   */
+  newas->vfile = v;
+
+  oldas = proc_setas(newas);
+  as_activate();
+
+  result = load_elf(v, &entrypoint);
+  if (result) {
+    goto fail;
+  }
+
+  result = as_define_stack(newas, &stackptr);
+  if (result) {
+    goto fail;
+  }
+
+  result = execv_copyout(buf, argc, argstart, used, &stackptr, &uargv);
+  if (result) {
+    goto fail;
+  }
+
+  argbuf_put(buf);
+
+  /* the new image is in place: drop the old one (unless it is the vfork parent's) */
+  if (!proc_vfork_done(curproc) && oldas != NULL) {
+    as_destroy(oldas);
+  }
+
+  enter_new_process(argc, uargv, NULL /*env*/, stackptr, entrypoint);
+
+  panic("enter_new_process returned\n");
+  return EINVAL;
+
+fail:
+  /* as_define_region/as_define_stack leave all cleanup to as_destroy */
+  proc_setas(oldas);
+  as_activate();
+  as_destroy(newas);
+  argbuf_put(buf);
+  return result;
+}
 #endif
@@ -0,0 +1,71 @@
+/*
+ * System calls for the paging virtual memory system.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/time.h>
+#include <kern/resource.h>
+#include <syscall.h>
+#include <lib.h>
+#include <proc.h>
+#include <current.h>
+#include <addrspace.h>
+#include <copyinout.h>
+
+/*
+ * sbrk: move the break of the current process by AMOUNT bytes and
+ * return the old one. The heap pages are zero-filled on demand by
+ * vm_fault().
+ */
+int
+sys_sbrk(intptr_t amount, vaddr_t *retval)
+{
+  struct addrspace *as;
+
+  as = proc_getas();
+  if (as == NULL) {
+    return EFAULT;
+  }
+
+  return as_sbrk(as, amount, retval);
+}
+
+/*
+ * getrusage: VM statistics of the current process (RUSAGE_SELF only).
+ * Minor faults are the ones served without I/O (TLB reloads, page
+ * cache hits, zero-filled and copy-on-write pages), major faults read
+ * the page from the ELF file or from the swapfile. Blocks are pages.
+ * OS/161 keeps no kb-ticks integrals: ru_idrss and ru_isrss report
+ * the current resident and swapped out size (kb) instead.
+ */
+int
+sys_getrusage(int who, userptr_t usage)
+{
+  struct addrspace *as;
+  struct as_stats st;
+  struct rusage ru;
+
+  if (who != RUSAGE_SELF) {
+    return EINVAL;
+  }
+
+  as = proc_getas();
+  if (as == NULL) {
+    return EFAULT;
+  }
+
+  as_stats_get(as, &st);
+
+  bzero(&ru, sizeof(ru));
+  ru.ru_maxrss = st.resident_max * (PAGE_SIZE / 1024);
+  ru.ru_idrss = st.resident * (PAGE_SIZE / 1024);
+  ru.ru_isrss = st.swapped * (PAGE_SIZE / 1024);
+  ru.ru_minflt = st.faults_tlb + st.faults_zero + st.faults_cow;
+  ru.ru_majflt = st.faults_elf + st.faults_swap;
+  ru.ru_nswap = st.swapouts;
+  ru.ru_inblock = st.faults_elf + st.faults_swap;
+  ru.ru_oublock = st.swapouts;
+
+  return copyout(&ru, usage, sizeof(ru));
+}
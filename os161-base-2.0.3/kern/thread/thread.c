@@ -48,6 +48,9 @@
 #include <current.h>
 #include <synch.h>
 #include <addrspace.h>
+#if OPT_PAGING
+#include <coremap.h>
+#endif
 #include <mainbus.h>
 #include <vnode.h>
 
@@ -188,6 +191,14 @@ cpu_create(unsigned hardware_number)
 	c->c_numshootdown = 0;
 	spinlock_init(&c->c_ipi_lock);
 
+#if OPT_PAGING
+	bzero(c->c_vmstats, sizeof(c->c_vmstats));
+	bzero(c->c_vmlat, sizeof(c->c_vmlat));
+	bzero(c->c_vmlat_ns, sizeof(c->c_vmlat_ns));
+	c->c_vmlat_seq = 0;
+	c->c_vmlat_gen = 0;
+#endif
+
 	result = cpuarray_add(&allcpus, c, &c->c_number);
 	if (result != 0) {
 		panic("cpu_create: array_add: %s\n", strerror(result));
@@ -644,7 +655,22 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 		next = threadlist_remhead(&curcpu->c_runqueue);
 		if (next == NULL) {
 			spinlock_release(&curcpu->c_runqueue_lock);
+#if OPT_PAGING
+			/*
+			 * Use the idle time to zero a free frame for
+			 * the zero-fill page faults (vm/coremap.c),
+			 * letting pending interrupts in after each one.
+			 */
+			if (coremap_prezero()) {
+				cpu_irqon();
+				cpu_irqoff();
+			}
+			else {
+				cpu_idle();
+			}
+#else
 			cpu_idle();
+#endif
 			spinlock_acquire(&curcpu->c_runqueue_lock);
 		}
 	} while (next == NULL);
@@ -1111,6 +1137,21 @@ ipi_send(struct cpu *target, int code)
 	spinlock_release(&target->c_ipi_lock);
 }
 
+/*
+ * Number of cpus, and the cpu with a given number.
+ */
+unsigned
+cpu_count(void)
+{
+	return cpuarray_num(&allcpus);
+}
+
+struct cpu *
+cpu_get(unsigned n)
+{
+	return cpuarray_get(&allcpus, n);
+}
+
 /*
  * Send an IPI to all CPUs.
  */
@@ -1162,6 +1203,38 @@ ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping)
 	spinlock_release(&target->c_ipi_lock);
 }
 
+/*
+ * Send several TLB shootdowns to the specified CPU with a single IPI.
+ * If the target's queue doesn't have room, spin (with interrupts on,
+ * so shootdowns aimed at us still get handled) until it drains.
+ */
+void
+ipi_tlbshootdown_batch(struct cpu *target,
+		       const struct tlbshootdown *mappings, unsigned n)
+{
+	unsigned i, k;
+
+	KASSERT(n > 0 && n <= TLBSHOOTDOWN_MAX);
+	KASSERT(curcpu->c_spinlocks == 0);
+
+	spinlock_acquire(&target->c_ipi_lock);
+	while (target->c_numshootdown + n > TLBSHOOTDOWN_MAX) {
+		spinlock_release(&target->c_ipi_lock);
+		spinlock_acquire(&target->c_ipi_lock);
+	}
+
+	k = target->c_numshootdown;
+	for (i=0; i<n; i++) {
+		target->c_shootdown[k+i] = mappings[i];
+	}
+	target->c_numshootdown = k+n;
+
+	target->c_ipi_pending |= (uint32_t)1 << IPI_TLBSHOOTDOWN;
+	mainbus_send_ipi(target);
+
+	spinlock_release(&target->c_ipi_lock);
+}
+
 /*
  * Handle an incoming interprocessor interrupt.
  */
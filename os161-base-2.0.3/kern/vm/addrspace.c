@@ -42,6 +42,10 @@
 #include <vm_tlb.h>
 #include <swapfile.h>
 #include <vmstats.h>
+#include <vmtrace.h>
+#include <clock.h>
+#include <vnode.h>
+#include <synch.h>
 
 /*
  * Note! If OPT_DUMBVM is set, as is the case until you start the VM
@@ -52,6 +56,13 @@
 
 #define PAGING_STACKPAGES    18
 
+//numero di pagine precaricate da vm_fault_around (0 = disabilitato)
+static int vm_faultaround = FAULTAROUND_DEFAULT;
+static int vm_cow = 1; //fork copy-on-write (0: as_copy copia subito le pagine)
+//utenti del campionamento del working set (vmtop con un conteggio, loadctl): 0 = vm_ws_sample non fa niente
+static int vm_ws_users = 0;
+static struct spinlock vm_ws_lock = SPINLOCK_INITIALIZER;
+
 void
 vm_bootstrap(void)
 {
@@ -74,8 +85,7 @@ void vm_shutdown(void)
 void
 vm_tlbshootdown(const struct tlbshootdown *ts)
 {
-	(void)ts;
-	panic("dumbvm tried to do tlb shootdown?!\n");
+	tlb_shootdown_handle(ts);
 }
 
 void can_sleep(void)
@@ -89,263 +99,632 @@ void can_sleep(void)
 	}
 }
 
-int vm_fault(int faulttype, vaddr_t faultaddress)
+/*
+ * Percorso lento di vm_fault: la pagina non è in memoria. Unica routine per tutti i segmenti:
+ * alloca un frame (eventualmente facendo swap out di una vittima) e lo riempie dallo swapfile,
+ * dal file ELF (code e data) oppure con zeri (stack e heap).
+ * tlbfault è 0 quando la pagina viene portata in memoria da vm_pin_range: non c'è stato un tlb miss,
+ * quindi la TLB viene aggiornata senza contarlo.
+ */
+static int vm_fault_slow(struct addrspace *as, struct segment *seg, int index_page_table, vaddr_t faultaddress,
+			 uint64_t start, int tlbfault)
 {
-	vaddr_t vbase1, vtop1, vbase2, vtop2, stackbase, stacktop;
+	struct entry *e = &seg->entries[index_page_table];
 	paddr_t paddr;
-	struct addrspace *as;
-	int index_page_table;
-	int result;
+	int result, lat, event, slot, prezeroed = 0;
 
+	if (seg == as->page_table->code && e->swapIndex == -1)
+	{
+		//pagina di codice già in memoria per un altro processo che esegue lo stesso file: condivido il frame
+		paddr = pagecache_lookup(as->vfile, index_page_table, as, faultaddress); //aggiorna anche la entry
+		if (paddr != 0)
+		{
+			if (tlbfault)
+			{
+				tlb_insert(faultaddress, paddr, seg->readonly);
+				vmstats_increment(TLB_RELOADS);
+				as->stats.faults_tlb++;
+			}
+			else
+			{
+				tlb_update(faultaddress, paddr, seg->readonly);
+			}
+			vmstats_increment(PAGECACHE_HITS);
+			vmlat_record(VMLAT_FAULT_RELOAD, start);
+			VMTRACE(VMT_FAULT_RELOAD, as, faultaddress, paddr, -1);
+			return 0;
+		}
+	}
 
-	faultaddress &= PAGE_FRAME; //indirizzo logico (pagina) in cui avviene il tlb fault
-
-	DEBUG(DB_VM, "dumbvm: fault: 0x%x\n", faultaddress);
+	//gestisce anche un eventuale swap out per liberare un frame. Il frame è BUSY_IN.
+	//Le pagine anonime nuove (stack e heap) arrivano già azzerate, se possibile dai frame azzerati nel ciclo idle
+	if (e->swapIndex == -1 && seg != as->page_table->code && seg != as->page_table->data)
+	{
+		paddr = alloc_upage_zero(faultaddress, &prezeroed);
+	}
+	else
+	{
+		paddr = alloc_upage(faultaddress);
+	}
+	KASSERT((paddr & PAGE_FRAME) == paddr);
+	as->ws_faults[as->ws_epoch % (WS_INTERVALS + 1)]++;
 
-	switch (faulttype) {
-	    case VM_FAULT_READONLY:
-		//panic("dumbvm: got VM_FAULT_READONLY\n"); NON DEVE ANDARE IN PANIC! Deve solo terminare il processo
-			return EACCES;
+	e->valid_bit = 1; // convalido la pagina
+	e->paddr = paddr;
+	slot = e->swapIndex;
 
-	    case VM_FAULT_READ:
-	    case VM_FAULT_WRITE:
-		break;
-	    default:
-		return EINVAL;
+	if (e->swapIndex != -1)
+	{
+		//SWAP IN: lo slot viene liberato da swapin
+		swapin(e->swapIndex, paddr);
+		e->swapIndex = -1;
+		vmstats_increment(PAGE_FAULTS_DISK);
+		vmstats_increment(PAGE_FAULTS_SWAP);
+		as->stats.faults_swap++;
+		as_stats_pages(as, 0, -1);
+		lat = VMLAT_FAULT_SWAP;
+		event = VMT_FAULT_SWAP;
+	}
+	else if (seg == as->page_table->code || seg == as->page_table->data)
+	{
+		//niente swap: la pagina va letta dal file ELF
+		result = load_page(as, index_page_table, paddr, seg == as->page_table->code ? 0 : 1);
+		if (result)
+		{
+			return result;
+		}
+		if (seg == as->page_table->code)
+		{
+			pagecache_insert(paddr, as->vfile, index_page_table);
+		}
+		as->stats.faults_elf++;
+		lat = VMLAT_FAULT_ELF;
+		event = VMT_FAULT_ELF;
+	}
+	else
+	{
+		//stack e heap: pagina anonima, già azzerata da alloc_upage_zero
+		vmstats_increment(PAGE_FAULTS_ZEROED);
+		if (prezeroed)
+		{
+			vmstats_increment(PAGE_FAULTS_PREZEROED);
+		}
+		as->stats.faults_zero++;
+		lat = VMLAT_FAULT_ZERO;
+		event = VMT_FAULT_ZERO;
 	}
 
-	if (curproc == NULL) {
-		/*
-		 * No process. This is probably a kernel fault early
-		 * in boot. Return EFAULT so as to panic instead of
-		 * getting into an infinite faulting loop.
-		 */
-		return EFAULT;
+	if (tlbfault)
+	{
+		tlb_insert(faultaddress, paddr, seg->readonly);
+	}
+	else
+	{
+		tlb_update(faultaddress, paddr, seg->readonly);
 	}
+	coremap_ready(paddr);
+	vmlat_record(lat, start);
+	VMTRACE(event, as, faultaddress, paddr, slot);
 
-	as = proc_getas();
-	if (as == NULL) {
-		/*
-		 * No address space set up. This is probably also a
-		 * kernel fault early in boot.
-		 */
-		return EFAULT;
+	return 0;
+}
+
+//Le pagine dei segmenti scrivibili ancora condivise dopo una fork vanno mappate in sola lettura
+static uint8_t vm_readonly(struct segment *seg, struct entry *e)
+{
+	return seg->readonly || coremap_isshared(e->paddr);
+}
+
+/*
+ * Scrittura su una pagina copy-on-write: se il frame è ancora condiviso il processo ne riceve una copia
+ * privata, altrimenti (l'altro processo ha già copiato o è terminato) basta renderlo scrivibile.
+ * Non è un tlb fault: la entry è già nella TLB, va solo aggiornata.
+ */
+static int vm_fault_cow(struct addrspace *as, struct entry *e, vaddr_t faultaddress)
+{
+	paddr_t paddr, old;
+	struct tlb_batch batch;
+
+	//il frame viene bloccato in memoria finché non è stato copiato
+	if (e->valid_bit == 0 || coremap_pin(e->paddr))
+	{
+		//la pagina è stata spostata nello swapfile: l'istruzione verrà rieseguita con un normale tlb fault
+		return 0;
 	}
 
+	vmstats_increment(COW_FAULTS);
+	as->stats.faults_cow++;
 
-	KASSERT(as->page_table != NULL);
+	old = e->paddr;
+	if (coremap_isshared(old))
+	{
+		paddr = alloc_upage(faultaddress);
+		memmove((void *)PADDR_TO_KVADDR(paddr), (const void *)PADDR_TO_KVADDR(old), PAGE_SIZE);
+		coremap_unpin(old);
 
-	KASSERT(as->page_table->code != NULL);
-	KASSERT(as->page_table->data != NULL);
-	KASSERT(as->page_table->stack != NULL);
+		//un'altra CPU che ha eseguito il processo può avere ancora la traduzione verso il vecchio frame
+		tlb_batch_init(&batch);
+		tlb_shootdown_add(&batch, as, faultaddress);
+		tlb_shootdown_send(&batch);
 
-	KASSERT(as->page_table->code->v_base!=0);
-	KASSERT(as->page_table->code->npages!=0);
-	KASSERT(as->page_table->code->entries!=NULL);
+		if (coremap_unshare(old, as))
+		{
+			//il vecchio frame è finito nello swapfile prima di essere rilasciato: la entry punta allo slot condiviso
+			swap_free(e->swapIndex);
+			e->swapIndex = -1;
+			as_stats_pages(as, 0, -1);
+		}
 
-	KASSERT(as->page_table->data->v_base!=0);
-	KASSERT(as->page_table->data->npages!=0);
-	KASSERT(as->page_table->data->entries!=NULL);
+		e->paddr = paddr;
+		e->valid_bit = 1;
+		tlb_update(faultaddress, paddr, 0);
+		coremap_ready(paddr);
+		vmstats_increment(COW_COPIES);
+	}
+	else
+	{
+		tlb_update(faultaddress, old, 0);
+		coremap_unpin(old);
+	}
 
-	KASSERT(as->page_table->stack->v_base!=0);
-	KASSERT(as->page_table->stack->npages!=0);
-	KASSERT(as->page_table->stack->entries!=NULL);
+	return 0;
+}
 
-	//gli indirizzi logici di partenza dei segmenti devono essere allineati alla pagina
-	KASSERT((as->page_table->code->v_base & PAGE_FRAME) == as->page_table->code->v_base);
-	KASSERT((as->page_table->data->v_base & PAGE_FRAME) == as->page_table->data->v_base);
-	KASSERT((as->page_table->stack->v_base & PAGE_FRAME) == as->page_table->stack->v_base);
+void vm_set_cow(int enable)
+{
+	vm_cow = enable ? 1 : 0;
+}
 
-	//Cercare nella ram l'indirizzo fisico fisico corrispondente all'indirizzo logico del faultaddress e CONTROLLARE VALID BIT.
-	//Se non è valida la entry significa che non è in memoria perché non è stato caricato ancora oppure la pagina è stata sostituita.
-	//Se è presente in memoria carico semplicemente nella TLB.
-	//Se non è presente, devo cercare un frame libero
+//Aggiorna pagine residenti e pagine nello swapfile di as (variazioni con segno)
+void as_stats_pages(struct addrspace *as, int resident, int swapped)
+{
+	spinlock_acquire(&as->stats_lock);
+	as->stats.resident += resident;
+	if (as->stats.resident > as->stats.resident_max)
+		as->stats.resident_max = as->stats.resident;
+	as->stats.swapped += swapped;
+	spinlock_release(&as->stats_lock);
+}
 
-	//devo capire in quale segmento fa parte il faultaddress. 
+//Una pagina di as è stata tolta dalla memoria da una eviction; swapped se è stata scritta nello swapfile
+void as_stats_evicted(struct addrspace *as, int swapped)
+{
+	spinlock_acquire(&as->stats_lock);
+	as->stats.resident--;
+	if (swapped)
+	{
+		as->stats.swapped++;
+		as->stats.swapouts++;
+	}
+	spinlock_release(&as->stats_lock);
+}
 
+//Copia coerente delle statistiche di as
+void as_stats_get(struct addrspace *as, struct as_stats *st)
+{
+	spinlock_acquire(&as->stats_lock);
+	*st = as->stats;
+	spinlock_release(&as->stats_lock);
+}
 
-	//incremento tlb_faults
-	vmstats_increment(TLB_FAULTS);
+void vm_set_faultaround(int npages)
+{
+	if (npages < 0)
+		npages = 0;
+	if (npages > FAULTAROUND_MAX)
+		npages = FAULTAROUND_MAX;
+	vm_faultaround = npages;
+}
+
+/*
+ * Stima quante entry precaricate dall'ultimo fault-around sono state usate. La TLB non ha un bit
+ * di riferimento, quindi si guarda dove cade il fault successivo: se la scansione è proseguita oltre
+ * la finestra (o dentro di essa), le pagine precaricate attraversate senza fault sono state usate.
+ * Un fault lontano dalla finestra (salto) non conta nessun uso.
+ */
+static void vm_faultaround_account(struct addrspace *as, vaddr_t faultaddress)
+{
+	unsigned int used = 0;
+
+	if (as->fa_hi == as->fa_lo)
+	{
+		return;
+	}
+
+	if (as->fa_lo > as->fa_last)
+	{
+		//finestra in avanti: [fa_last + PAGE_SIZE, fa_hi)
+		if (faultaddress >= as->fa_lo && faultaddress <= as->fa_hi)
+		{
+			used = (faultaddress - as->fa_lo) / PAGE_SIZE;
+		}
+	}
+	else
+	{
+		//finestra all'indietro: [fa_lo, fa_last)
+		if (faultaddress + PAGE_SIZE >= as->fa_lo && faultaddress < as->fa_hi)
+		{
+			used = (as->fa_hi - PAGE_SIZE - faultaddress) / PAGE_SIZE;
+		}
+	}
 
-	vbase1 = as->page_table->code->v_base;
-	vtop1 = vbase1 + as->page_table->code->npages * PAGE_SIZE;
+	//la finestra può contenere pagine che erano già nella TLB: non sono state precaricate
+	if (used > as->fa_count)
+	{
+		used = as->fa_count;
+	}
+	if (used > 0)
+	{
+		vmstats_add(TLB_PRELOADS_USED, used);
+	}
 
-	vbase2 = as->page_table->data->v_base;
-	vtop2 = vbase2 + as->page_table->data->npages * PAGE_SIZE;
+	as->fa_lo = as->fa_hi = 0;
+	as->fa_count = 0;
+}
 
-	stackbase = as->page_table->stack->v_base;//ricorda: lo stack cresce scendendo con l'indirizzo logico!
-	stacktop = stackbase + as->page_table->stack->npages * PAGE_SIZE;
+/*
+ * Fault-around: dopo un TLB reload carica nella TLB anche le pagine residenti successive a quella del fault
+ * (precedenti se l'ultimo fault era più in alto, come in una scansione all'indietro). Si ferma alla prima pagina
+ * non residente o alla fine del segmento.
+ */
+static void vm_fault_around(struct addrspace *as, struct segment *seg, int index_page_table, vaddr_t faultaddress)
+{
+	int i, j, dir;
+	unsigned n = 0;
+	struct entry *e;
 
-	if (faultaddress >= vbase1 && faultaddress < vtop1) { //l'indirizzo faultaddress è contenuto dentro il segmento di code
+	dir = faultaddress < as->fa_last ? -1 : 1;
 
-		// accedo direttamente a as->page_table->code->entries trovando l'indice di tale vettore
-		
-		index_page_table = (int) (faultaddress - vbase1)/PAGE_SIZE;
-		if(as->page_table->code->entries[index_page_table].valid_bit == 0)
+	for (i = 1; i <= vm_faultaround; i++)
+	{
+		j = index_page_table + dir * i;
+		if (j < 0 || j >= (int)seg->npages)
 		{
-			//Non è in memoria perché il valid bit della page table è uguale a 0
+			break;
+		}
 
-			paddr = alloc_upage(faultaddress); //gestisce anche un eventuale swap out per liberare un frame
-									//se non è possibile fare neanche swap, allora termina il processo (system call)
-									//alloc upages gestisce anche la modifica della coremap e l'eventuale swap
-			
+		e = &seg->entries[j];
+		if (e->valid_bit == 0 || coremap_isbusy(e->paddr))
+		{
+			break;
+		}
 
-			KASSERT((paddr & PAGE_FRAME) == paddr);
+		if (tlb_preload(seg->v_base + j * PAGE_SIZE, e->paddr, vm_readonly(seg, e)))
+		{
+			n++;
+			e->ws_epoch = as->ws_epoch; //probabilmente usata: non deve uscire dal working set senza fault
+		}
+	}
 
-			as->page_table->code->entries[index_page_table].valid_bit = 1; // convalido la pagina
-			as->page_table->code->entries[index_page_table].paddr = paddr;
+	if (n > 0)
+	{
+		vmstats_add(TLB_PRELOADS, n);
+	}
+	as->fa_count = n;
 
-			
+	//finestra [fa_lo, fa_hi) delle pagine considerate, esclusa quella del fault
+	if (dir > 0)
+	{
+		as->fa_lo = faultaddress + PAGE_SIZE;
+		as->fa_hi = faultaddress + i * PAGE_SIZE;
+	}
+	else
+	{
+		as->fa_lo = faultaddress - (i - 1) * PAGE_SIZE;
+		as->fa_hi = faultaddress;
+	}
+}
 
-			if(as->page_table->code->entries[index_page_table].swapIndex == -1)
-			{
-				//niente swap: non è nello swapfile
-				result = load_page(as, index_page_table, paddr, 0); 
-				if (result)
-				{
-					return result;
-				}
+//Conta le pagine del segmento riferite dall'intervallo from in poi
+static int vm_ws_count(struct segment *seg, unsigned from)
+{
+	unsigned int i;
+	int n = 0;
 
-			
-			}
-			else
-			{
-				//SWAP IN -code
-				swapin(as->page_table->code->entries[index_page_table].swapIndex,paddr);
-				vmstats_increment(PAGE_FAULTS_DISK);
-				vmstats_increment(PAGE_FAULTS_SWAP);
-			}
+	for (i = 0; i < seg->npages; i++)
+	{
+		if (seg->entries[i].ws_epoch >= from)
+			n++;
+	}
 
-			tlb_insert(faultaddress, paddr, 1);
+	return n;
+}
 
+//Tempo in tick (1/HZ secondi) dall'orologio di gettime, comune a tutte le CPU: c_hardclocks è per CPU e un
+//processo che cambia CPU confronterebbe contatori diversi
+static unsigned vm_ws_now(void)
+{
+	struct timespec ts;
 
+	gettime(&ts);
+	return ts.tv_sec * HZ + ts.tv_nsec / (1000000000 / HZ);
+}
 
-		}
-		else
-		{
-			
+//Attiva (on) o rilascia (!on) il campionamento del working set. Resta attivo finché ha almeno un utente
+void vm_ws_enable(int on)
+{
+	spinlock_acquire(&vm_ws_lock);
+	vm_ws_users += on ? 1 : -1;
+	KASSERT(vm_ws_users >= 0);
+	spinlock_release(&vm_ws_lock);
+}
 
-			paddr = as->page_table->code->entries[index_page_table].paddr;
+int vm_ws_active(void)
+{
+	return vm_ws_users > 0;
+}
 
-			KASSERT((paddr & PAGE_FRAME) == paddr); // deve avere gli ultimi bit (dell'offset) uguali a 0
+/*
+ * Stima del working set (Denning) e della page-fault frequency di as, chiamata da vm_fault nel contesto del
+ * processo. Un riferimento a una pagina si vede solo come tlb fault, che registra l'intervallo corrente nella entry
+ * (ws_epoch). Per campionare anche le pagine che restano nella TLB, all'inizio di ogni intervallo le traduzioni
+ * del processo vengono tolte da tutte le TLB (anche quella software): il primo accesso a ogni pagina usata
+ * nell'intervallo diventa un reload. Il working set sono le pagine riferite negli ultimi WS_INTERVALS intervalli,
+ * residenti o no; un processo che non fa tlb fault non aggiorna la stima (il suo working set sta nella TLB).
+ * Lo svuotamento delle TLB costa uno shootdown e fa perdere al processo TLB e TLB software: si campiona solo
+ * mentre qualcuno usa la stima (vm_ws_enable), altrimenti WSS e PFF restano all'ultimo valore.
+ */
+static void vm_ws_sample(struct addrspace *as)
+{
+	struct pt *pt = as->page_table;
+	unsigned now, n, i, faults;
+	int wss;
 
-			tlb_insert(faultaddress, paddr, 1); //l'1 indica che è readonly, quindi il dirty bit della tlb sarà settato a 0
+	//letto senza lock, come isCoremapActive: al peggio un campione in più o in meno
+	if (vm_ws_users == 0)
+	{
+		return;
+	}
 
-			vmstats_increment(TLB_RELOADS);
+	now = vm_ws_now();
+	if (now - as->ws_tick < WS_SAMPLE_TICKS)
+	{
+		return;
+	}
 
-		}
+	//avanza di un intervallo per ogni WS_SAMPLE_TICKS passati (al più tutta la finestra), azzerandone i fault
+	n = (now - as->ws_tick) / WS_SAMPLE_TICKS;
+	if (n > WS_INTERVALS + 1)
+		n = WS_INTERVALS + 1;
+	as->ws_tick = now;
+	for (i = 0; i < n; i++)
+	{
+		as->ws_epoch++;
+		as->ws_faults[as->ws_epoch % (WS_INTERVALS + 1)] = 0;
+	}
 
+	faults = 0;
+	for (i = 0; i < WS_INTERVALS + 1; i++)
+	{
+		faults += as->ws_faults[i];
 	}
-	else
-		if (faultaddress >= vbase2 && faultaddress < vtop2) { //l'indirizzo faultaddress è contenuto dentro il segmento di code
 
-			// accedo direttamente a as->page_table->data->entries trovando l'indice di tale vettore
-			
-			index_page_table = (int) (faultaddress - vbase2)/PAGE_SIZE;
-			if(as->page_table->data->entries[index_page_table].valid_bit == 0)
-			{
-				//Non è in memoria perché il valid bit della page table è uguale a 0
+	//finestra: gli ultimi WS_INTERVALS intervalli conclusi (quello appena iniziato è vuoto)
+	wss = vm_ws_count(pt->code, as->ws_epoch - WS_INTERVALS) + vm_ws_count(pt->data, as->ws_epoch - WS_INTERVALS) +
+	      vm_ws_count(pt->stack, as->ws_epoch - WS_INTERVALS) + vm_ws_count(pt->heap, as->ws_epoch - WS_INTERVALS);
 
-				paddr = alloc_upage(faultaddress); //se non è possibile fare neanche swap, allora termina il processo (system call)
-									//alloc upages gestisce anche la modifica della coremap e l'eventuale swap
-			
+	spinlock_acquire(&as->stats_lock);
+	as->stats.wss = wss;
+	as->stats.pff = faults * HZ / (WS_INTERVALS * WS_SAMPLE_TICKS);
+	spinlock_release(&as->stats_lock);
 
-				KASSERT((paddr & PAGE_FRAME) == paddr);
+	tlb_invalid_as(as);
+}
 
-				as->page_table->data->entries[index_page_table].valid_bit = 1; // convalido la pagina
-				as->page_table->data->entries[index_page_table].paddr = paddr;
+int vm_fault(int faulttype, vaddr_t faultaddress)
+{
+	struct addrspace *as;
+	struct segment *seg;
+	struct entry *e;
+	int index_page_table, spl, result;
+	uint64_t start;
 
+	start = vmlat_start(); //istogrammi delle latenze per tipo di fault
+	faultaddress &= PAGE_FRAME; //indirizzo logico (pagina) in cui avviene il tlb fault
 
-				if(as->page_table->data->entries[index_page_table].swapIndex == -1)
-				{
-					//niente swap: non è nello swapfile
-					result = load_page(as, index_page_table, paddr, 1); 
-					if (result)
-					{
-						return result;
-					}
-				
-				}
-				else
-				{
-					//SWAP IN - data
-					swapin(as->page_table->data->entries[index_page_table].swapIndex,paddr);
-					vmstats_increment(PAGE_FAULTS_DISK);
-					vmstats_increment(PAGE_FAULTS_SWAP);
-				}
+	DEBUG(DB_VM, "paging: fault: 0x%x\n", faultaddress);
 
-				tlb_insert(faultaddress, paddr, 0);
-				
-			}
-			else
-			{
-				paddr = as->page_table->data->entries[index_page_table].paddr;
+	switch (faulttype) {
+	    case VM_FAULT_READONLY:
+		//panic("dumbvm: got VM_FAULT_READONLY\n"); NON DEVE ANDARE IN PANIC! Deve solo terminare il processo
+		//(scrittura sul codice) oppure, per gli altri segmenti, copiare la pagina copy-on-write
+	    case VM_FAULT_READ:
+	    case VM_FAULT_WRITE:
+		break;
+	    default:
+		return EINVAL;
+	}
 
-				KASSERT((paddr & PAGE_FRAME) == paddr); // deve avere gli ultimi bit (dell'offset) uguali a 0
+	if (curproc == NULL) {
+		/*
+		 * No process. This is probably a kernel fault early
+		 * in boot. Return EFAULT so as to panic instead of
+		 * getting into an infinite faulting loop.
+		 */
+		return EFAULT;
+	}
 
-				tlb_insert(faultaddress, paddr, 0);
+	as = proc_getas();
+	if (as == NULL) {
+		/*
+		 * No address space set up. This is probably also a
+		 * kernel fault early in boot.
+		 */
+		return EFAULT;
+	}
 
-				vmstats_increment(TLB_RELOADS);
-			}
+	//La struttura della page table viene verificata una sola volta (pt_check) quando l'addrspace è completo,
+	//non ad ogni tlb miss.
+
+	vm_ws_sample(as);
 
+	if (faulttype == VM_FAULT_READONLY)
+	{
+		seg = pt_get_segment(faultaddress, as);
+		if (seg == NULL || seg->readonly)
+		{
+			return EACCES;
 		}
-		else
-			if (faultaddress >= stackbase && faultaddress < stacktop){
-				
-				
-				//Attenzione: lo stack è decrescente, E ANCHE nella page table è decrescente.
+		seg->entries[(faultaddress - seg->v_base) / PAGE_SIZE].ws_epoch = as->ws_epoch;
+		lock_acquire(as->pt_lock);
+		result = vm_fault_cow(as, &seg->entries[(faultaddress - seg->v_base) / PAGE_SIZE], faultaddress);
+		lock_release(as->pt_lock);
+		vmlat_record(VMLAT_FAULT_COW, start);
+		VMTRACE(VMT_FAULT_COW, as, faultaddress, seg->entries[(faultaddress - seg->v_base) / PAGE_SIZE].paddr, -1);
+		return result;
+	}
 
+	//incremento tlb_faults
+	vmstats_increment(TLB_FAULTS);
 
-				index_page_table = (faultaddress - stackbase) / PAGE_SIZE;
-				if(as->page_table->stack->entries[index_page_table].valid_bit == 0)
-				{
-					
-					//Non è in memoria perché il valid bit della page table è uguale a 0
+	//TLB software: una traduzione già caricata (e poi rimpiazzata nella TLB) non va cercata nella page table
+	stlb_setup();
+	if (tlb_reload_soft(faultaddress))
+	{
+		vmstats_increment(TLB_RELOADS);
+		vmstats_increment(STLB_HITS);
+		as->stats.faults_tlb++;
+		vmlat_record(VMLAT_FAULT_RELOAD, start);
+		VMTRACE(VMT_FAULT_RELOAD, as, faultaddress, 0, -1); //il frame è solo nella TLB software
+		return 0;
+	}
 
-					paddr = alloc_upage(faultaddress); //se non è possibile fare neanche swap, allora termina il processo (system call)
-										//alloc upages gestisce anche la modifica della coremap e l'eventuale swap
-				
-					
+	//Cerco il segmento partendo dall'ultimo usato: i fault consecutivi cadono quasi sempre nello stesso segmento
+	seg = as->last_seg;
+	if (seg == NULL || faultaddress < seg->v_base || faultaddress - seg->v_base >= seg->npages * PAGE_SIZE)
+	{
+		seg = pt_get_segment(faultaddress, as);
+		if (seg == NULL)
+		{
+			return EFAULT;
+		}
+		as->last_seg = seg;
+	}
+
+	index_page_table = (faultaddress - seg->v_base) / PAGE_SIZE;
+	e = &seg->entries[index_page_table];
+	e->ws_epoch = as->ws_epoch;
 
-					KASSERT((paddr & PAGE_FRAME) == paddr);
+	vm_faultaround_account(as, faultaddress);
 
-					as->page_table->stack->entries[index_page_table].valid_bit = 1; // convalido la pagina
-					as->page_table->stack->entries[index_page_table].paddr = paddr;
+	//Controllo del frame e scrittura nella TLB senza interruzioni: la pagina non può diventare vittima nel frattempo
+	spl = splhigh();
+	while (e->valid_bit == 1 && coremap_isbusy(e->paddr))
+	{
+		//il frame sta andando nello swapfile: alla fine la entry dirà dove si trova la pagina
+		splx(spl);
+		coremap_wait(e->paddr);
+		spl = splhigh();
+	}
 
+	if (e->valid_bit == 0)
+	{
+		//Non è in memoria perché il valid bit della page table è uguale a 0.
+		//Il lock della page table è tenuto anche durante l'I/O: serializza solo i fault dello stesso addrspace
+		splx(spl);
+		as->fa_last = faultaddress;
+		lock_acquire(as->pt_lock);
+		result = vm_fault_slow(as, seg, index_page_table, faultaddress, start, 1);
+		lock_release(as->pt_lock);
+		return result;
+	}
 
+	//Percorso veloce (TLB_RELOADS): la pagina è già in memoria, basta caricarla nella TLB.
+	//Per il segmento code readonly=1, quindi il dirty bit della tlb sarà settato a 0 (anche per le pagine copy-on-write)
+	tlb_insert(faultaddress, e->paddr, vm_readonly(seg, e));
+	vmstats_increment(TLB_RELOADS);
+	as->stats.faults_tlb++;
 
-					if(as->page_table->stack->entries[index_page_table].swapIndex != -1)
-					{
-						//è necessario fare lo swap in
-						swapin(as->page_table->stack->entries[index_page_table].swapIndex,paddr);
-						vmstats_increment(PAGE_FAULTS_DISK);
-						vmstats_increment(PAGE_FAULTS_SWAP);
-					}
-					else
-					{
-						bzero((void* ) PADDR_TO_KVADDR(paddr), PAGE_SIZE);
-						vmstats_increment(PAGE_FAULTS_ZEROED);
-					}
-					
-					tlb_insert(faultaddress, paddr, 0);
+	if (vm_faultaround > 0)
+	{
+		vm_fault_around(as, seg, index_page_table, faultaddress);
+	}
+	splx(spl);
+	as->fa_last = faultaddress;
+	vmlat_record(VMLAT_FAULT_RELOAD, start);
+	VMTRACE(VMT_FAULT_RELOAD, as, faultaddress, e->paddr, -1);
 
-				}
-				else
-				{
-					paddr = as->page_table->stack->entries[index_page_table].paddr;
+	return 0;
+}
 
-					KASSERT((paddr & PAGE_FRAME) == paddr); // deve avere gli ultimi bit (dell'offset) uguali a 0
+/*
+ * Porta in memoria e blocca le pagine utente di [vaddr, vaddr + len) dell'addrspace corrente, che non verranno
+ * scelte come vittime finché il kernel le usa (I/O da dispositivo, copie). Se write, le pagine ancora condivise
+ * dopo una fork vengono prima copiate: il frame bloccato deve essere quello che il processo mappa.
+ * Al massimo PIN_MAXPAGES pagine per chiamata (ENOMEM oltre).
+ */
+int vm_pin_range(vaddr_t vaddr, size_t len, int write)
+{
+	struct addrspace *as = proc_getas();
+	struct segment *seg;
+	struct entry *e;
+	vaddr_t page, end;
+	int result;
 
-					tlb_insert(faultaddress, paddr, 0);
+	if (len == 0)
+		return 0;
 
-					vmstats_increment(TLB_RELOADS);
-				}
+	end = vaddr + len;
+	if (end < vaddr || end > USERSPACETOP)
+		return EFAULT;
+	if ((end - (vaddr & PAGE_FRAME) + PAGE_SIZE - 1) / PAGE_SIZE > PIN_MAXPAGES)
+		return ENOMEM;
+
+	for (page = vaddr & PAGE_FRAME; page < end; page += PAGE_SIZE)
+	{
+		seg = pt_get_segment(page, as);
+		if (seg == NULL || (write && seg->readonly))
+		{
+			result = EFAULT;
+			goto fail;
+		}
+		e = &seg->entries[(page - seg->v_base) / PAGE_SIZE];
+
+		for (;;)
+		{
+			if (e->valid_bit == 0)
+			{
+				//non è un tlb miss: niente statistiche dei tlb fault né latenza, solo il caricamento della pagina
+				lock_acquire(as->pt_lock);
+				result = e->valid_bit ? 0 : vm_fault_slow(as, seg, (page - seg->v_base) / PAGE_SIZE, page, 0, 0);
+				lock_release(as->pt_lock);
+				if (result)
+					goto fail;
 			}
-			else
+			else if (write && !seg->readonly && coremap_isshared(e->paddr))
+			{
+				//come in vm_fault, la copia della pagina condivisa si fa con il lock della page table
+				lock_acquire(as->pt_lock);
+				vm_fault_cow(as, e, page);
+				lock_release(as->pt_lock);
+			}
+			else if (coremap_pin(e->paddr) == 0)
 			{
-				return EFAULT;
+				break;
 			}
+		}
+	}
+
 	return 0;
+
+fail:
+	if (page > (vaddr & PAGE_FRAME))
+		vm_unpin_range(vaddr & PAGE_FRAME, page - (vaddr & PAGE_FRAME));
+	return result;
+}
+
+void vm_unpin_range(vaddr_t vaddr, size_t len)
+{
+	struct addrspace *as = proc_getas();
+	struct entry *e;
+	vaddr_t page;
+
+	for (page = vaddr & PAGE_FRAME; page < vaddr + len; page += PAGE_SIZE)
+	{
+		e = get_pt_entry(page, as);
+		KASSERT(e != NULL && e->valid_bit == 1);
+		coremap_unpin(e->paddr);
+	}
 }
 
 
@@ -410,281 +789,289 @@ as_create(void)
 	as->page_table->stack->npages = 0;
 	as->page_table->stack->readonly = 0;
 
-	return as;
-}
-
-int
-as_copy(struct addrspace *old, struct addrspace **ret)
-{
-	struct addrspace *newas;
-	unsigned int i;
-	paddr_t paddr;
-
-	newas = as_create();
-	if (newas==NULL) {
-		return ENOMEM;
+	as->page_table->heap = kmalloc(sizeof(struct segment));
+	if(as->page_table->heap == NULL)
+	{
+		kfree(as->page_table->code);
+		kfree(as->page_table->data);
+		kfree(as->page_table->stack);
+		kfree(as->page_table);
+		kfree(as);
+		return NULL;
 	}
 
-	newas->vfile = old->vfile;
+	as->page_table->heap->entries = NULL;
+	as->page_table->heap->v_base = 0;
+	as->page_table->heap->npages = 0;
+	as->page_table->heap->readonly = 0;
 
-	newas->page_table->code->v_base = old->page_table->code->v_base;
-	newas->page_table->code->npages = old->page_table->code->npages;
-	newas->page_table->code->readonly = old->page_table->code->readonly;
+	as->pt_lock = lock_create("pt");
+	if (as->pt_lock == NULL)
+	{
+		kfree(as->page_table->code);
+		kfree(as->page_table->data);
+		kfree(as->page_table->stack);
+		kfree(as->page_table->heap);
+		kfree(as->page_table);
+		kfree(as);
+		return NULL;
+	}
 
-	newas->page_table->code->entries = kmalloc(newas->page_table->code->npages * sizeof(struct entry));
+	as->vfile = NULL; //impostato da runprogram (dopo load_elf) e da execv (prima)
+	as->heap_end = 0;
+	as->last_seg = NULL;
+	as->fa_last = 0;
+	as->fa_lo = 0;
+	as->fa_hi = 0;
+	as->fa_count = 0;
+	as->prefault = 0;
+	as->tlb_asid = 0; //assegnato alla prima attivazione
+	as->tlb_gen = 0;
+	as->tlb_cpumask = 0;
+	bzero(&as->stats, sizeof(struct as_stats));
+	spinlock_init(&as->stats_lock);
+	as->ws_epoch = WS_INTERVALS + 1; //le entry mai riferite (ws_epoch 0) restano sempre fuori dalla finestra
+	as->ws_tick = vm_ws_now();
+	bzero(as->ws_faults, sizeof(as->ws_faults));
 
-	newas->page_table->data->v_base = old->page_table->data->v_base;
-	newas->page_table->data->npages = old->page_table->data->npages;
-	newas->page_table->data->readonly = old->page_table->data->readonly;
+	return as;
+}
 
-	newas->page_table->data->entries = kmalloc(newas->page_table->data->npages * sizeof(struct entry));
+//Duplica il segmento old in new. Le pagine in memoria vengono condivise con newas (il codice sempre, le altre
+//se vm_cow è attivo, altrimenti vengono copiate in nuovi frame di newas); quelle nello swapfile condividono lo slot
+static int
+as_copy_segment(struct addrspace *newas, struct segment *old, struct segment *new)
+{
+	unsigned int i;
+	paddr_t paddr;
+	int result;
 
-	newas->page_table->stack->v_base = old->page_table->stack->v_base;
-	newas->page_table->stack->npages = old->page_table->stack->npages;
-	newas->page_table->stack->readonly = old->page_table->stack->readonly;
+	new->v_base = old->v_base;
+	new->npages = old->npages;
+	new->readonly = old->readonly;
 
-	newas->page_table->stack->entries = kmalloc(newas->page_table->stack->npages * sizeof(struct entry));
+	if (new->npages == 0)
+	{
+		//segmento vuoto (es. heap mai cresciuto)
+		new->entries = NULL;
+		return 0;
+	}
 
-	if(newas->page_table->code->entries == NULL || newas->page_table->data->entries == NULL || newas->page_table->stack->entries == NULL)
+	new->entries = kmalloc(new->npages * sizeof(struct entry));
+	if (new->entries == NULL)
 	{
-		kfree(newas->page_table->code);
-		kfree(newas->page_table->data);
-		kfree(newas->page_table->stack);
-		kfree(newas->page_table);
-		vfs_close(newas->vfile);
-		kfree(newas);
+		new->npages = 0; //così as_destroy non scorre un vettore inesistente
 		return ENOMEM;
 	}
 
-	for(i = 0; i < newas->page_table->code->npages; i++)
+	for(i = 0; i < new->npages; i++)
 	{
-		if(old->page_table->code->entries[i].valid_bit == 1 ) // entry valida
-		{
-			//duplico in memoria la pagina
-			paddr = alloc_upage(newas->page_table->code->v_base + i*PAGE_SIZE);
+		new->entries[i].paddr = 0;
+		new->entries[i].valid_bit = 0;
+		new->entries[i].swapIndex = -1;
+		new->entries[i].ws_epoch = 0;
 
-			newas->page_table->code->entries[i].paddr = paddr;
-			newas->page_table->code->entries[i].valid_bit = 1;
-			newas->page_table->code->entries[i].swapIndex = -1;
-
-			memmove((void *)PADDR_TO_KVADDR(newas->page_table->code->entries[i].paddr),
-			(const void *)PADDR_TO_KVADDR(old->page_table->code->entries[i].paddr),
-			PAGE_SIZE);
-
-		}
-		else // entry non valida
+	retry:
+		if(old->entries[i].valid_bit == 1 && (old->readonly || vm_cow))
 		{
-			if(old->page_table->code->entries[i].swapIndex != -1)
+			//pagina in memoria: il frame viene condiviso. Il codice non viene mai scritto, le altre pagine
+			//sono mappate in sola lettura e copiate al primo accesso in scrittura (copy-on-write, vm_fault_cow).
+			//coremap_share scrive anche la entry del figlio
+			result = coremap_share(old->entries[i].paddr, newas, new->v_base + i*PAGE_SIZE);
+			if (result == EAGAIN)
 			{
-				//scrivo in memoria la pagina che è dentro lo swap file per poi duplicarla
-				paddr = alloc_upage(old->page_table->code->v_base + i*PAGE_SIZE); //indirizzo logico della pagina i
-
-				swapin(old->page_table->code->entries[i].swapIndex, paddr);
-
-				paddr = alloc_upage(newas->page_table->code->v_base + i*PAGE_SIZE);
-
-				newas->page_table->code->entries[i].paddr = paddr;
-				newas->page_table->code->entries[i].valid_bit = 1;
-				newas->page_table->code->entries[i].swapIndex = -1;
-
-				memmove((void *)PADDR_TO_KVADDR(newas->page_table->code->entries[i].paddr),
-				(const void *)PADDR_TO_KVADDR(old->page_table->code->entries[i].paddr),
-				PAGE_SIZE);
-
+				//il frame è appena finito nello swapfile: la entry del padre punta ora allo slot
+				goto retry;
 			}
-			else // non è nemmeno nello swap file nello swap file ---> setto tutto invalid
+			if (result)
 			{
-				newas->page_table->code->entries[i].paddr = 0;
-				newas->page_table->code->entries[i].valid_bit = 0;
-				newas->page_table->code->entries[i].swapIndex = -1;
+				new->npages = i + 1; //as_destroy deve scorrere solo le entry già inizializzate
+				return ENOMEM;
 			}
 		}
-	}
-
-
-	//------------------- data
-
-	for(i = 0; i < newas->page_table->data->npages; i++)
-	{
-		if(old->page_table->data->entries[i].valid_bit == 1 ) // entry valida
+		else if(old->entries[i].valid_bit == 0 && old->entries[i].swapIndex != -1)
 		{
-			//duplico in memoria la pagina
-			paddr = alloc_upage(newas->page_table->data->v_base + i*PAGE_SIZE);
-
-			newas->page_table->data->entries[i].paddr = paddr;
-			newas->page_table->data->entries[i].valid_bit = 1;
-			newas->page_table->data->entries[i].swapIndex = -1;
-
-			memmove((void *)PADDR_TO_KVADDR(newas->page_table->data->entries[i].paddr),
-			(const void *)PADDR_TO_KVADDR(old->page_table->data->entries[i].paddr),
-			PAGE_SIZE);
-
+			//pagina nello swapfile: il figlio punta allo stesso slot, nessuna lettura. Chi la riporta in memoria
+			//per primo ne ottiene una copia privata (swapin rilascia solo il proprio riferimento)
+			swap_share(old->entries[i].swapIndex);
+			new->entries[i].swapIndex = old->entries[i].swapIndex;
+			as_stats_pages(newas, 0, 1);
+			vmstats_increment(SWAP_FORK_SHARED);
 		}
-		else // entry non valida
+		else if(old->entries[i].valid_bit == 1)
 		{
-			if(old->page_table->data->entries[i].swapIndex != -1)
+			//copia immediata in un nuovo frame del figlio; il frame del padre resta bloccato in memoria durante la copia
+			if (coremap_pin(old->entries[i].paddr))
 			{
-				//scrivo in memoria la pagina che è dentro lo swap file per poi duplicarla
-				paddr = alloc_upage(old->page_table->data->v_base + i*PAGE_SIZE); //indirizzo logico della pagina i
-
-				swapin(old->page_table->data->entries[i].swapIndex, paddr);
-
-				paddr = alloc_upage(newas->page_table->data->v_base + i*PAGE_SIZE);
-
-				newas->page_table->data->entries[i].paddr = paddr;
-				newas->page_table->data->entries[i].valid_bit = 1;
-				newas->page_table->data->entries[i].swapIndex = -1;
+				goto retry;
+			}
+			paddr = alloc_upage_as(newas, new->v_base + i*PAGE_SIZE);
 
-				memmove((void *)PADDR_TO_KVADDR(newas->page_table->data->entries[i].paddr),
-				(const void *)PADDR_TO_KVADDR(old->page_table->data->entries[i].paddr),
+			memmove((void *)PADDR_TO_KVADDR(paddr),
+				(const void *)PADDR_TO_KVADDR(old->entries[i].paddr),
 				PAGE_SIZE);
+			coremap_unpin(old->entries[i].paddr);
 
-			}
-			else // non è nemmeno nello swap file nello swap file ---> setto tutto invalid
-			{
-				newas->page_table->data->entries[i].paddr = 0;
-				newas->page_table->data->entries[i].valid_bit = 0;
-				newas->page_table->data->entries[i].swapIndex = -1;
-			}
+			new->entries[i].paddr = paddr;
+			new->entries[i].valid_bit = 1;
+			coremap_ready(paddr);
 		}
 	}
 
-	//-----------------------stack
-
-	for(i = 0; i < newas->page_table->stack->npages; i++)
-	{
-		if(old->page_table->stack->entries[i].valid_bit == 1 ) // entry valida
-		{
-			//duplico in memoria la pagina
-			paddr = alloc_upage(newas->page_table->stack->v_base + i*PAGE_SIZE);
-
-			newas->page_table->stack->entries[i].paddr = paddr;
-			newas->page_table->stack->entries[i].valid_bit = 1;
-			newas->page_table->stack->entries[i].swapIndex = -1;
-
-			memmove((void *)PADDR_TO_KVADDR(newas->page_table->stack->entries[i].paddr),
-			(const void *)PADDR_TO_KVADDR(old->page_table->stack->entries[i].paddr),
-			PAGE_SIZE);
-
-		}
-		else // entry non valida
-		{
-			if(old->page_table->stack->entries[i].swapIndex != -1)
-			{
-				//scrivo in memoria la pagina che è dentro lo swap file per poi duplicarla
-				paddr = alloc_upage(old->page_table->stack->v_base + i*PAGE_SIZE); //indirizzo logico della pagina i
-
-				swapin(old->page_table->stack->entries[i].swapIndex, paddr);
+	return 0;
+}
 
-				paddr = alloc_upage(newas->page_table->stack->v_base + i*PAGE_SIZE);
+int
+as_copy(struct addrspace *old, struct addrspace **ret)
+{
+	struct addrspace *newas;
 
-				newas->page_table->stack->entries[i].paddr = paddr;
-				newas->page_table->stack->entries[i].valid_bit = 1;
-				newas->page_table->stack->entries[i].swapIndex = -1;
+	newas = as_create();
+	if (newas==NULL) {
+		return ENOMEM;
+	}
 
-				memmove((void *)PADDR_TO_KVADDR(newas->page_table->stack->entries[i].paddr),
-				(const void *)PADDR_TO_KVADDR(old->page_table->stack->entries[i].paddr),
-				PAGE_SIZE);
+	//il file ELF è condiviso: ogni addrspace ne tiene un riferimento, rilasciato in as_destroy
+	VOP_INCREF(old->vfile);
+	newas->vfile = old->vfile;
+	newas->heap_end = old->heap_end;
 
-			}
-			else // non è nemmeno nello swap file nello swap file ---> setto tutto invalid
-			{
-				newas->page_table->stack->entries[i].paddr = 0;
-				newas->page_table->stack->entries[i].valid_bit = 0;
-				newas->page_table->stack->entries[i].swapIndex = -1;
-			}
-		}
+	lock_acquire(old->pt_lock);
+	if(as_copy_segment(newas, old->page_table->code, newas->page_table->code) ||
+	   as_copy_segment(newas, old->page_table->data, newas->page_table->data) ||
+	   as_copy_segment(newas, old->page_table->stack, newas->page_table->stack) ||
+	   as_copy_segment(newas, old->page_table->heap, newas->page_table->heap))
+	{
+		lock_release(old->pt_lock);
+		as_destroy(newas);
+		return ENOMEM;
 	}
+	lock_release(old->pt_lock);
 
-	
+	pt_check(newas);
+
+	//le TLB (anche di altre CPU) possono contenere entry scrivibili del padre per frame ora condivisi: le rimuovo
+	tlb_invalid_as(old);
 
 	*ret = newas;
 	return 0;
 }
 
-void
-as_destroy(struct addrspace *as)
-{
+/*
+ * Teardown a batch: as_destroy raccoglie le entry in memoria e gli slot dello swapfile del processo e li rilascia
+ * DESTROY_BATCH alla volta, prendendo i lock della coremap e dello swapfile una volta per batch. Il batch contiene
+ * puntatori alle entry, quindi va svuotato prima di liberare il segmento.
+ */
+#define DESTROY_BATCH 32
 
-	unsigned int i;
-	/*
-	 * Clean up as needed.
-	 */
+struct teardown {
+	struct entry *frames[DESTROY_BATCH];
+	int nframes;
+	int slots[DESTROY_BATCH];
+	int nslots;
+};
 
-	can_sleep();
+static void
+as_teardown_flush(struct addrspace *as, struct teardown *td)
+{
+	int i;
 
-	//libera il segmento code
+	coremap_release_batch(as, td->frames, td->nframes);
+	swap_free_batch(td->slots, td->nslots);
 
-	for(i = 0; i < as->page_table->code->npages; i++)
+	//frame finiti nello swapfile mentre erano nel batch: coremap_release_batch li ha lasciati alla eviction
+	for (i = 0; i < td->nframes; i++)
 	{
-		if(as->page_table->code->entries[i].valid_bit == 1)
-		{
-			freeppage_user(as->page_table->code->entries[i].paddr);
-		}
-		else
+		if (td->frames[i]->valid_bit == 0 && td->frames[i]->swapIndex != -1)
 		{
-			if(as->page_table->code->entries[i].swapIndex != -1)
-			{
-				//non è in memoria ma nello swap file
-				swap_free(as->page_table->code->entries[i].swapIndex);
-			}
+			swap_free(td->frames[i]->swapIndex);
 		}
 	}
 
-	kfree(as->page_table->code->entries);
-	kfree(as->page_table->code);
+	td->nframes = 0;
+	td->nslots = 0;
+}
 
+//Aggiunge al batch tutti i frame e le pagine dello swapfile di un segmento (il segmento lo libera as_destroy)
+static void
+as_destroy_segment(struct addrspace *as, struct segment *seg, struct teardown *td)
+{
+	unsigned int i;
 
-	//libera il segmento data
-	for(i = 0; i < as->page_table->data->npages; i++)
+	for(i = 0; i < seg->npages; i++)
 	{
-		if(as->page_table->data->entries[i].valid_bit == 1)
+		if(seg->entries[i].valid_bit == 1)
 		{
-			freeppage_user(as->page_table->data->entries[i].paddr);
+			td->frames[td->nframes++] = &seg->entries[i];
 		}
-		else
+		else if(seg->entries[i].swapIndex != -1)
 		{
-			if(as->page_table->data->entries[i].swapIndex != -1)
-			{
-				//non è in memoria ma nello swap file
-				swap_free(as->page_table->data->entries[i].swapIndex);
-			}
+			//non è in memoria ma nello swap file
+			td->slots[td->nslots++] = seg->entries[i].swapIndex;
+		}
+
+		if(td->nframes == DESTROY_BATCH || td->nslots == DESTROY_BATCH)
+		{
+			as_teardown_flush(as, td);
 		}
 	}
+	as_teardown_flush(as, td);
+}
 
-	kfree(as->page_table->data->entries);
-	kfree(as->page_table->data);
+static void
+as_free_segment(struct segment *seg)
+{
+	kfree(seg->entries);
+	kfree(seg);
+}
 
+void
+as_destroy(struct addrspace *as)
+{
+	struct teardown td;
+	struct timespec before, after, duration;
 
+	/*
+	 * Clean up as needed.
+	 */
 
-	//libera il segmento di stack
+	can_sleep();
 
+	gettime(&before);
 
-	for(i = 0; i < as->page_table->stack->npages; i++)
-	{
-		if(as->page_table->stack->entries[i].valid_bit == 1)
-		{
-			freeppage_user(as->page_table->stack->entries[i].paddr);
-		}
-		else
-		{
-			if(as->page_table->stack->entries[i].swapIndex != -1)
-			{
-				//non è in memoria ma nello swap file
-				swap_free(as->page_table->stack->entries[i].swapIndex);
-			}
-		}
-	}
+	//nessuna TLB deve più tradurre verso i frame che stanno per essere liberati
+	tlb_forget(as);
 
-	invalidVictim();
+	td.nframes = 0;
+	td.nslots = 0;
+	as_destroy_segment(as, as->page_table->code, &td);
+	as_destroy_segment(as, as->page_table->data, &td);
+	as_destroy_segment(as, as->page_table->stack, &td);
+	as_destroy_segment(as, as->page_table->heap, &td);
 
-	kfree(as->page_table->stack->entries);
-	kfree(as->page_table->stack);
+	//I segmenti si liberano solo dopo aver svuotato tutti i batch: finché un frame dell'addrspace è in memoria
+	//la eviction può cercarne la entry (get_pt_entry), che scorre tutti e quattro i segmenti
+	as_free_segment(as->page_table->code);
+	as_free_segment(as->page_table->data);
+	as_free_segment(as->page_table->stack);
+	as_free_segment(as->page_table->heap);
 
+	//la coda FIFO non viene azzerata: coremap_release_batch la mantiene già coerente e contiene ancora
+	//i frame degli altri processi, compresi quelli di codice condivisi
 
 	kfree(as->page_table);
-	vfs_close(as->vfile);
+	lock_destroy(as->pt_lock);
+	spinlock_cleanup(&as->stats_lock);
+	if (as->vfile != NULL)
+	{
+		//load_elf può essere fallita prima che il file venisse assegnato all'addrspace
+		vfs_close(as->vfile);
+	}
 	kfree(as);
+
+	gettime(&after);
+	timespec_sub(&after, &before, &duration);
+	vmstats_teardown(duration.tv_sec * 1000000000ULL + duration.tv_nsec);
 }
 
 void
@@ -701,11 +1088,7 @@ as_activate(void)
 		return;
 	}
 
-	tlb_invalid();
-
-	vmstats_increment(TLB_INVALIDATIONS);
-
-	
+	tlb_activate(as);
 }
 
 void
@@ -759,12 +1142,9 @@ as_define_region(struct addrspace *as, vaddr_t vaddr, size_t sz,
 
 		if(as->page_table->code->entries == NULL)
 		{
-			kfree(as->page_table->code);
-			kfree(as->page_table->data);
-			kfree(as->page_table->stack);
-			kfree(as->page_table);
-			kfree(as);
-
+			//segmento vuoto: as_destroy, chiamata dal chiamante, libera il resto dell'addrspace
+			as->page_table->code->v_base = 0;
+			as->page_table->code->npages = 0;
 			return ENOMEM;
 		} 
 
@@ -773,6 +1153,7 @@ as_define_region(struct addrspace *as, vaddr_t vaddr, size_t sz,
 			as->page_table->code->entries[i].valid_bit = 0;
 			as->page_table->code->entries[i].paddr = 0;
 			as->page_table->code->entries[i].swapIndex = -1;
+			as->page_table->code->entries[i].ws_epoch = 0;
 		}
 
 		return 0;
@@ -785,12 +1166,9 @@ as_define_region(struct addrspace *as, vaddr_t vaddr, size_t sz,
 
 		if(as->page_table->data->entries == NULL)
 		{
-			kfree(as->page_table->code);
-			kfree(as->page_table->data);
-			kfree(as->page_table->stack);
-			kfree(as->page_table);
-			kfree(as);
-
+			//segmento vuoto: as_destroy, chiamata dal chiamante, libera il resto dell'addrspace
+			as->page_table->data->v_base = 0;
+			as->page_table->data->npages = 0;
 			return ENOMEM;
 		} 
 
@@ -799,6 +1177,7 @@ as_define_region(struct addrspace *as, vaddr_t vaddr, size_t sz,
 			as->page_table->data->entries[i].valid_bit = 0;
 			as->page_table->data->entries[i].paddr = 0;
 			as->page_table->data->entries[i].swapIndex = -1;
+			as->page_table->data->entries[i].ws_epoch = 0;
 		}
 
 
@@ -825,8 +1204,19 @@ as_prepare_load(struct addrspace *as)
 int
 as_complete_load(struct addrspace *as)
 {
+	vaddr_t codetop, datatop;
+
 	can_sleep();
-	(void)as;
+
+	//l'heap parte vuoto subito sopra il segmento più alto tra code e data (già allineati alla pagina)
+	codetop = as->page_table->code->v_base + as->page_table->code->npages * PAGE_SIZE;
+	datatop = as->page_table->data->v_base + as->page_table->data->npages * PAGE_SIZE;
+
+	as->page_table->heap->v_base = codetop > datatop ? codetop : datatop;
+	as->page_table->heap->npages = 0;
+	as->page_table->heap->entries = NULL;
+	as->heap_end = as->page_table->heap->v_base;
+
 	return 0;
 }
 
@@ -839,13 +1229,9 @@ as_define_stack(struct addrspace *as, vaddr_t *stackptr)
 
 	if (as->page_table->stack->entries == NULL)
 	{
-		kfree(as->page_table->code);
-		kfree(as->page_table->data);
-		kfree(as->page_table->stack);
-		kfree(as->page_table);
-		kfree(as);
-
-		return ENOMEM;	
+		//segmento vuoto: as_destroy, chiamata dal chiamante, libera il resto dell'addrspace
+		as->page_table->stack->npages = 0;
+		return ENOMEM;
 	}
 
 	for(int i = 0; i<PAGING_STACKPAGES; i++)
@@ -853,9 +1239,26 @@ as_define_stack(struct addrspace *as, vaddr_t *stackptr)
 		as->page_table->stack->entries[i].valid_bit = 0;
 		as->page_table->stack->entries[i].paddr = 0;
 		as->page_table->stack->entries[i].swapIndex = -1;
+		as->page_table->stack->entries[i].ws_epoch = 0;
 
 	}
 
+	//programma caricato subito da load_elf: preparo anche le pagine in cima allo stack, che saranno usate per prime
+	if (as->prefault)
+	{
+		for(int i = PAGING_STACKPAGES - PREFAULT_STACKPAGES; i<PAGING_STACKPAGES; i++)
+		{
+			//non è un page fault: il frame azzerato in anticipo non va contato in PAGE_FAULTS_PREZEROED
+			paddr_t paddr = alloc_upage_zero(as->page_table->stack->v_base + i * PAGE_SIZE, NULL);
+			as->page_table->stack->entries[i].paddr = paddr;
+			as->page_table->stack->entries[i].valid_bit = 1;
+			coremap_ready(paddr);
+			vmstats_increment(PAGES_PREFAULTED);
+		}
+	}
+
+	//l'addrspace è completo: verifico una volta la struttura della page table
+	pt_check(as);
 
 	/* Initial user-level stack pointer */
 	*stackptr = USERSTACK;
@@ -863,3 +1266,130 @@ as_define_stack(struct addrspace *as, vaddr_t *stackptr)
 	return 0;
 }
 
+/*
+ * Sposta il break di AMOUNT byte (multiplo di PAGE_SIZE) e ritorna quello vecchio in OLDBREAK.
+ * Le nuove pagine non vengono allocate: saranno azzerate da vm_fault al primo accesso.
+ * Le pagine rilasciate da una riduzione liberano subito il frame o la pagina dello swapfile.
+ */
+static int
+as_sbrk_locked(struct addrspace *as, intptr_t amount, vaddr_t *oldbreak)
+{
+	struct segment *heap;
+	struct entry *entries, *oldentries;
+	vaddr_t newbreak;
+	size_t npages, i;
+
+	heap = as->page_table->heap;
+
+	if ((amount & ~(intptr_t)PAGE_FRAME) != 0)
+	{
+		//supportiamo solo break allineati alla pagina (vedi man sbrk)
+		return EINVAL;
+	}
+
+	if (amount < 0)
+	{
+		if ((vaddr_t)0 - (vaddr_t)amount > as->heap_end - heap->v_base)
+		{
+			return EINVAL;
+		}
+	}
+	else
+	{
+		//l'heap non può invadere lo stack
+		if ((vaddr_t)amount > as->page_table->stack->v_base - as->heap_end)
+		{
+			return ENOMEM;
+		}
+	}
+
+	newbreak = as->heap_end + amount;
+	npages = (newbreak - heap->v_base) / PAGE_SIZE;
+
+	if (npages > heap->npages)
+	{
+		//la crescita è limitata dalla memoria ancora disponibile tra RAM e swapfile
+		if (npages - heap->npages > (size_t)(coremap_freeframes() + swap_freeslots()))
+		{
+			return ENOMEM;
+		}
+
+		entries = kmalloc(npages * sizeof(struct entry));
+		if (entries == NULL)
+		{
+			return ENOMEM;
+		}
+
+		for (i = heap->npages; i < npages; i++)
+		{
+			entries[i].valid_bit = 0;
+			entries[i].paddr = 0;
+			entries[i].swapIndex = -1;
+			entries[i].ws_epoch = 0;
+		}
+
+		//il vecchio vettore può essere aggiornato da uno swapout (anche su un'altra CPU) mentre lo copiamo
+		coremap_freeze();
+		if (heap->npages > 0)
+		{
+			memcpy(entries, heap->entries, heap->npages * sizeof(struct entry));
+		}
+		oldentries = heap->entries;
+		heap->entries = entries;
+		heap->npages = npages;
+		coremap_thaw();
+
+		kfree(oldentries);
+	}
+	else if (npages < heap->npages)
+	{
+		//le traduzioni spariscono da tutte le TLB prima che i frame vengano liberati
+		tlb_invalid_range(as, heap->v_base + npages * PAGE_SIZE, heap->v_base + heap->npages * PAGE_SIZE);
+
+		//prima libero le pagine, poi riduco il segmento: finché sono allocate devono restare raggiungibili da get_pt_entry
+		for (i = npages; i < heap->npages; i++)
+		{
+			if (heap->entries[i].valid_bit == 1)
+			{
+				if (coremap_unshare(heap->entries[i].paddr, as))
+				{
+					//il frame è finito nello swapfile prima di essere rilasciato
+					swap_free(heap->entries[i].swapIndex);
+					as_stats_pages(as, 0, -1);
+				}
+			}
+			else if (heap->entries[i].swapIndex != -1)
+			{
+				swap_free(heap->entries[i].swapIndex);
+				as_stats_pages(as, 0, -1);
+			}
+
+			heap->entries[i].valid_bit = 0;
+			heap->entries[i].paddr = 0;
+			heap->entries[i].swapIndex = -1;
+			heap->entries[i].ws_epoch = 0;
+		}
+
+		//il vettore resta allocato: verrà riusato (o sostituito) alla prossima crescita
+		heap->npages = npages;
+	}
+
+	*oldbreak = as->heap_end;
+	as->heap_end = newbreak;
+
+	return 0;
+}
+
+int
+as_sbrk(struct addrspace *as, intptr_t amount, vaddr_t *oldbreak)
+{
+	int result;
+
+	KASSERT(as != NULL);
+
+	lock_acquire(as->pt_lock);
+	result = as_sbrk_locked(as, amount, oldbreak);
+	lock_release(as->pt_lock);
+
+	return result;
+}
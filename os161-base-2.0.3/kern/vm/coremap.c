@@ -9,28 +9,50 @@
 #include <swapfile.h>
 #include <vmstats.h>
 #include <vm_tlb.h>
+#include <vmtrace.h>
+#include <wchan.h>
+#include <clock.h>
 
+/*
+ * Lock della coremap, in ordine di acquisizione:
+ *  - victim_lock: coda FIFO di rimpiazzamento (head, tail, prevAllocated, nextAllocated);
+ *  - frame_lock[]: per hash dell'indice, stato, mapping (as, vaddr, reverse map), refcount e page cache del frame user;
+ *  - coremap_lock: allocazione dei frame (occupied, freed, allocSize) e liste dei frame liberi, anche per il kernel;
+ *  - pcache_lock, rmap_lock, stealmem_lock: foglie.
+ * Prima di tutti viene il lock (sleep) della page table dell'addrspace, preso dai fault. Più frame lock insieme
+ * si prendono solo in ordine crescente (coremap_freeze).
+ */
 static struct spinlock stealmem_lock = SPINLOCK_INITIALIZER;
 static struct spinlock coremap_lock = SPINLOCK_INITIALIZER;
 static struct spinlock victim_lock = SPINLOCK_INITIALIZER;
+static struct spinlock pcache_lock = SPINLOCK_INITIALIZER; //liste della page cache
+static struct spinlock rmap_lock = SPINLOCK_INITIALIZER; //pool della reverse map e contatori dei frame condivisi
 static struct coremap_entry *coremap = NULL;
 static int coremapActive = 0;
 static int nRamFrames=0;
 static int tail = -1;
 static int head = -1;
+static int pcache[PCACHE_BUCKETS]; //testa (indice del frame) di ogni lista della page cache, -1 se vuota
+static int nshared_frames = 0; //frame mappati da più di un addrspace
+static int nshared_pages = 0;  //pagine risparmiate dalla condivisione: somma di (refcount - 1)
+static struct rmap_entry *rmap_pool = NULL; //nodi della reverse map, allocati una volta in coremap_init
+static int rmap_free = -1; //lista dei nodi liberi del pool
+//frame liberati, divisi in due liste (fprev/fnext) sotto coremap_lock: già azzerati e da azzerare
+static int zhead = -1;
+static int dhead = -1;
+static int nzeroed = 0;
+static int ndirty = 0;
+static struct spinlock frame_lock[FRAME_LOCKS];
+static struct wchan *frame_wchan[FRAME_LOCKS]; //attese sui frame occupati (BUSY_IN, BUSY_OUT, PINNED)
 
-void invalidVictim(void){
-	tail=-1;
-	head=-1;
-}
-//Controlla se la Coremap è attiva
+#define FRAME_LOCK(i) (&frame_lock[(i) % FRAME_LOCKS])
+#define FRAME_WCHAN(i) (frame_wchan[(i) % FRAME_LOCKS])
+
+//Controlla se la Coremap è attiva. Cambia solo all'avvio e allo spegnimento: la lettura non serve sotto lock,
+//che sarebbe l'unico globale preso da ogni operazione sui frame
 static int isCoremapActive()
 {
-	int active;
-	spinlock_acquire(&coremap_lock);
-	active = coremapActive;
-	spinlock_release(&coremap_lock);
-	return active;
+	return coremapActive;
 }
 
 //Alloca gli array con le informazioni della memoria e inizializza la coremap
@@ -54,8 +76,45 @@ void coremap_init(void)
 		coremap[i].nextAllocated = -1;
         coremap[i].as = NULL;
         coremap[i].vaddr = 0;
+		coremap[i].refcount = 0;
+		coremap[i].rmap = -1;
+		coremap[i].pc_vnode = NULL;
+		coremap[i].pc_page = 0;
+		coremap[i].pc_next = -1;
+		coremap[i].state = FRAME_FREE;
+		coremap[i].pincount = 0;
+		coremap[i].zeroed = 0;
+		coremap[i].fprev = -1;
+		coremap[i].fnext = -1;
+	}
+
+	for (i = 0; i < FRAME_LOCKS; i++)
+	{
+		spinlock_init(&frame_lock[i]);
+		frame_wchan[i] = wchan_create("frame");
+		if (frame_wchan[i] == NULL)
+		{
+			panic("Failed frame wait channel initialization");
+		}
+	}
+
+	for (i = 0; i < PCACHE_BUCKETS; i++)
+	{
+		pcache[i] = -1;
 	}
 
+	//pool dei mapping aggiuntivi dei frame condivisi
+	rmap_pool = kmalloc(sizeof(struct rmap_entry) * nRamFrames * RMAP_PER_FRAME);
+	if (rmap_pool == NULL)
+	{
+		panic("Failed reverse map initialization");
+	}
+	for (i = 0; i < nRamFrames * RMAP_PER_FRAME; i++)
+	{
+		rmap_pool[i].next = (i + 1 < nRamFrames * RMAP_PER_FRAME) ? i + 1 : -1;
+	}
+	rmap_free = 0;
+
 	tail = -1; //indice ultima allocata
 	head = -1; //indice prima allocata
 
@@ -65,15 +124,63 @@ void coremap_init(void)
 }
 
 void coremap_shutdown(void) {
+	int i;
+
 	//disattiva la coremap
 	spinlock_acquire(&coremap_lock);
 	coremapActive = 0;
 	spinlock_release(&coremap_lock);
 
 	kfree(coremap);
+	kfree(rmap_pool);
+	for (i = 0; i < FRAME_LOCKS; i++)
+	{
+		spinlock_cleanup(&frame_lock[i]);
+		wchan_destroy(frame_wchan[i]);
+	}
 }
 
 
+//Aggiunge il frame libero i alla lista dei frame azzerati (zeroed) o a quella dei frame da azzerare. Chiamata con coremap_lock
+static void flist_push(int i, bool zeroed)
+{
+	int *head = zeroed ? &zhead : &dhead;
+
+	coremap[i].zeroed = zeroed;
+	coremap[i].fprev = -1;
+	coremap[i].fnext = *head;
+	if (*head != -1)
+		coremap[*head].fprev = i;
+	*head = i;
+	if (zeroed)
+		nzeroed++;
+	else
+		ndirty++;
+}
+
+//Toglie il frame libero i dalla sua lista. Chiamata con coremap_lock
+static void flist_remove(int i)
+{
+	int *head = coremap[i].zeroed ? &zhead : &dhead;
+	int prev = coremap[i].fprev;
+	int next = coremap[i].fnext;
+
+	if (prev != -1)
+		coremap[prev].fnext = next;
+	else
+		*head = next;
+	if (next != -1)
+		coremap[next].fprev = prev;
+
+	if (coremap[i].zeroed)
+		nzeroed--;
+	else
+		ndirty--;
+	coremap[i].zeroed = 0;
+	coremap[i].fprev = -1;
+	coremap[i].fnext = -1;
+}
+
 //Cerca se c'è uno slot lungo npages libero da poter utilizzare. Se c'è lo occupa e ritorna l'indirizzo fisico di base
 static paddr_t getfreeppages(size_t npages, struct addrspace *as,vaddr_t vaddr) {
   paddr_t addr;	
@@ -83,7 +190,11 @@ static paddr_t getfreeppages(size_t npages, struct addrspace *as,vaddr_t vaddr)
   if (!isCoremapActive()) return 0; 
 
   spinlock_acquire(&coremap_lock);
-  for (i=0,first=found=-1; i<nRamFrames; i++) {
+  if (np == 1) {
+    //una sola pagina: i frame già azzerati restano ai fault zero-fill, finché ci sono altri frame liberi
+    found = (dhead != -1) ? dhead : zhead;
+  }
+  else for (i=0,first=found=-1; i<nRamFrames; i++) {
     if (coremap[i].freed) { //se è stato liberato
       if (i==0 || !coremap[i-1].freed)  //se è il primo slot della coremap o il precedente non era stato liberato significa
         first = i; //che è il primo slot libero dell'intervallo 
@@ -95,6 +206,7 @@ static paddr_t getfreeppages(size_t npages, struct addrspace *as,vaddr_t vaddr)
   }
   if(found>=0){ //se ha trovato lo spazio libero, setta anche l'addrspace e virtual address se presenti (USER), altrimenti NULL e 0 (KERNEL)
 	for(i=found; i<found+np;i++){
+		flist_remove(i);
 		coremap[i].occupied=1;
 		coremap[i].freed=0;
 		coremap[i].as=as;
@@ -141,6 +253,23 @@ static paddr_t getppages(size_t npages)
   return addr;
 }
 
+//Segna come libera la entry i della coremap e la mette tra i frame da azzerare. Chiamata con coremap_lock
+//(e, per i frame user, anche con il lock del frame)
+static void coremap_clear(int i)
+{
+	coremap[i].occupied = 0;
+	coremap[i].freed=1;
+	coremap[i].vaddr = 0;
+	coremap[i].as = NULL;
+	coremap[i].refcount = 0;
+	coremap[i].rmap = -1;
+	coremap[i].pc_vnode = NULL;
+	coremap[i].pc_next = -1;
+	coremap[i].state = FRAME_FREE;
+	coremap[i].pincount = 0;
+	flist_push(i, 0);
+}
+
 //Libera un numero desiderato di pagine a partire da addr
 static int freeppages(paddr_t addr, size_t npages)
 {
@@ -154,10 +283,7 @@ static int freeppages(paddr_t addr, size_t npages)
 	spinlock_acquire(&coremap_lock);
 	for (i = first; i < first + np; i++)
 	{
-		coremap[i].occupied = 0;
-		coremap[i].freed=1;
-		coremap[i].vaddr = 0;
-		coremap[i].as = NULL;
+		coremap_clear(i);
 	}
 	coremap[first].allocSize = 0;
 	spinlock_release(&coremap_lock);
@@ -165,6 +291,69 @@ static int freeppages(paddr_t addr, size_t npages)
 	return 1;
 }
 
+//Prende un frame dalla lista dei frame già azzerati, 0 se è vuota
+static paddr_t getzeroedppage(struct addrspace *as, vaddr_t vaddr)
+{
+	int i;
+
+	if (!isCoremapActive() || nzeroed == 0)
+		return 0;
+
+	spinlock_acquire(&coremap_lock);
+	i = zhead;
+	if (i != -1)
+	{
+		flist_remove(i);
+		coremap[i].occupied = 1;
+		coremap[i].freed = 0;
+		coremap[i].as = as;
+		coremap[i].vaddr = vaddr;
+		coremap[i].allocSize = 1;
+	}
+	spinlock_release(&coremap_lock);
+
+	return i == -1 ? 0 : (paddr_t)i * PAGE_SIZE;
+}
+
+/*
+ * Azzera un frame libero e lo mette nella lista dei frame azzerati. Chiamata dal ciclo idle dello scheduler
+ * (thread_switch) quando la CPU non ha niente da eseguire: ritorna 0 se non c'era niente da fare, e allora la CPU
+ * si ferma in cpu_idle. Il frame viene tolto dai liberi mentre lo si azzera senza lock.
+ * I contatori si leggono prima senza lock, come isCoremapActive, per non prendere coremap_lock a ogni giro.
+ */
+int coremap_prezero(void)
+{
+	int i;
+
+	if (!isCoremapActive() || ndirty == 0 || nzeroed >= ZPOOL_MAX)
+		return 0;
+
+	spinlock_acquire(&coremap_lock);
+	if (!coremapActive || ndirty == 0 || nzeroed >= ZPOOL_MAX)
+	{
+		spinlock_release(&coremap_lock);
+		return 0;
+	}
+	i = dhead;
+	flist_remove(i);
+	coremap[i].freed = 0;
+	coremap[i].occupied = 1;
+	spinlock_release(&coremap_lock);
+
+	bzero((void *)PADDR_TO_KVADDR((paddr_t)i * PAGE_SIZE), PAGE_SIZE);
+
+	spinlock_acquire(&coremap_lock);
+	if (coremapActive)
+	{
+		coremap[i].occupied = 0;
+		coremap[i].freed = 1;
+		flist_push(i, 1);
+	}
+	spinlock_release(&coremap_lock);
+
+	return 1;
+}
+
 //alloca alcune pagine virtuali dello spazio kernel
 vaddr_t alloc_kpages(size_t npages)
 {
@@ -190,20 +379,620 @@ void free_kpages(vaddr_t addr)
 	}
 }
 
+//Ritorna il numero di frame ancora assegnabili: quelli liberati e quelli mai presi con ram_stealmem
+int coremap_freeframes(void)
+{
+	int i, nfree = 0;
+
+	if (!isCoremapActive())
+		return 0;
+
+	spinlock_acquire(&coremap_lock);
+	for (i = 0; i < nRamFrames; i++)
+	{
+		if (coremap[i].freed)
+			nfree++;
+	}
+	spinlock_release(&coremap_lock);
+
+	spinlock_acquire(&stealmem_lock);
+	nfree += ram_getavail() / PAGE_SIZE;
+	spinlock_release(&stealmem_lock);
+
+	return nfree;
+}
+
+//PAGE CACHE E FRAME CONDIVISI
+
+static int pcache_hash(struct vnode *v, int page)
+{
+	return (int)((((uintptr_t)v >> 4) + (uintptr_t)page) % PCACHE_BUCKETS);
+}
+
+//Toglie il frame index dalla sua lista della page cache. Chiamata con il lock del frame
+static void pcache_unlink(int index)
+{
+	int *p;
+
+	spinlock_acquire(&pcache_lock);
+	p = &pcache[pcache_hash(coremap[index].pc_vnode, coremap[index].pc_page)];
+	while (*p != index)
+	{
+		KASSERT(*p != -1);
+		p = &coremap[*p].pc_next;
+	}
+	*p = coremap[index].pc_next;
+
+	coremap[index].pc_next = -1;
+	coremap[index].pc_vnode = NULL;
+	spinlock_release(&pcache_lock);
+}
+
+//Prende un nodo dal pool della reverse map, -1 se è esaurito. Chiamata con rmap_lock
+static int rmap_get(struct addrspace *as, vaddr_t vaddr)
+{
+	int r = rmap_free;
+
+	if (r == -1)
+		return -1;
+
+	rmap_free = rmap_pool[r].next;
+	rmap_pool[r].as = as;
+	rmap_pool[r].vaddr = vaddr;
+	rmap_pool[r].next = -1;
+
+	return r;
+}
+
+//Restituisce il nodo r al pool. Chiamata con rmap_lock
+static void rmap_put(int r)
+{
+	rmap_pool[r].as = NULL;
+	rmap_pool[r].next = rmap_free;
+	rmap_free = r;
+}
+
+//Aggiunge il mapping (as, vaddr) al frame index. Ritorna ENOMEM se il pool della reverse map è esaurito. Chiamata con il lock del frame
+static int coremap_addmap(int index, struct addrspace *as, vaddr_t vaddr)
+{
+	int r;
+
+	KASSERT(coremap[index].refcount > 0);
+
+	spinlock_acquire(&rmap_lock);
+	r = rmap_get(as, vaddr);
+	if (r != -1)
+	{
+		if (coremap[index].refcount == 1)
+			nshared_frames++;
+		nshared_pages++;
+		vmstats_shared(nshared_frames, nshared_pages);
+	}
+	spinlock_release(&rmap_lock);
+
+	if (r == -1)
+		return ENOMEM;
+
+	rmap_pool[r].next = coremap[index].rmap;
+	coremap[index].rmap = r;
+	coremap[index].refcount++;
+	as_stats_pages(as, 1, 0);
+
+	return 0;
+}
+
+//Stacca dal frame index tutti i mapping tranne quello principale. Chiamata con il lock del frame
+static void coremap_dropmaps(int index)
+{
+	int r, next;
+
+	spinlock_acquire(&rmap_lock);
+	if (coremap[index].refcount > 1)
+	{
+		nshared_frames--;
+		nshared_pages -= coremap[index].refcount - 1;
+	}
+
+	for (r = coremap[index].rmap; r != -1; r = next)
+	{
+		next = rmap_pool[r].next;
+		rmap_put(r);
+	}
+	spinlock_release(&rmap_lock);
+	coremap[index].rmap = -1;
+	coremap[index].refcount = 1;
+}
+
+/*
+ * Invalida nelle TLB le traduzioni del frame index, usando la reverse map: quelle della CPU corrente subito, quelle
+ * delle altre CPU che eseguono uno degli addrspace vanno nel batch b, spedito dal chiamante senza lock.
+ * Chiamata con il lock del frame
+ */
+static void coremap_tlb_invalid(int index, struct tlb_batch *b)
+{
+	int r;
+
+	tlb_shootdown_add(b, coremap[index].as, coremap[index].vaddr);
+
+	for (r = coremap[index].rmap; r != -1; r = rmap_pool[r].next)
+	{
+		tlb_shootdown_add(b, rmap_pool[r].as, rmap_pool[r].vaddr);
+	}
+}
+
+/*
+ * Il frame index, scelto come vittima, è stato salvato: usando la reverse map invalida esattamente le entry della
+ * page table di tutti gli addrspace che lo mappano. Le entry puntano tutte allo slot swap_index dello swapfile,
+ * oppure a -1 per le pagine di codice in page cache, che non vanno nello swapfile e verranno rilette dal file ELF.
+ * Chiamata con il lock del frame.
+ */
+static void coremap_unmap_all(int index, int swap_index)
+{
+	struct entry *e;
+	int r;
+
+	e = get_pt_entry(coremap[index].vaddr, coremap[index].as);
+	KASSERT(e != NULL);
+	e->valid_bit = 0;
+	e->swapIndex = swap_index;
+	as_stats_evicted(coremap[index].as, swap_index != -1);
+
+	for (r = coremap[index].rmap; r != -1; r = rmap_pool[r].next)
+	{
+		e = get_pt_entry(rmap_pool[r].vaddr, rmap_pool[r].as);
+		KASSERT(e != NULL);
+		if (swap_index != -1)
+			swap_share(swap_index);
+		e->valid_bit = 0;
+		e->swapIndex = swap_index;
+		as_stats_evicted(rmap_pool[r].as, swap_index != -1);
+	}
+
+	if (coremap[index].pc_vnode != NULL)
+		pcache_unlink(index);
+
+	coremap_dropmaps(index);
+}
+
+/*
+ * Toglie il mapping di as dal frame index, che resta usato da altri addrspace (refcount già decrementato e > 0).
+ * Chiamata con il lock del frame
+ */
+static void coremap_dropmap(int index, struct addrspace *as)
+{
+	int r, *pr;
+
+	KASSERT(coremap[index].refcount > 0);
+	KASSERT(coremap[index].rmap != -1);
+
+	if (coremap[index].as == as)
+	{
+		//il primo mapping della reverse map diventa quello principale
+		r = coremap[index].rmap;
+		coremap[index].as = rmap_pool[r].as;
+		coremap[index].vaddr = rmap_pool[r].vaddr;
+		coremap[index].rmap = rmap_pool[r].next;
+	}
+	else
+	{
+		for (pr = &coremap[index].rmap; *pr != -1; pr = &rmap_pool[*pr].next)
+		{
+			if (rmap_pool[*pr].as == as)
+				break;
+		}
+		KASSERT(*pr != -1);
+		r = *pr;
+		*pr = rmap_pool[r].next;
+	}
+	spinlock_acquire(&rmap_lock);
+	rmap_put(r);
+	if (coremap[index].refcount == 1)
+		nshared_frames--;
+	nshared_pages--;
+	spinlock_release(&rmap_lock);
+}
+
+//Attende che il frame index non sia più in BUSY_OUT. Ritorna 1 se ha dovuto aspettare. Chiamata con il lock del frame
+static int coremap_wait_out(int index)
+{
+	int waited = 0;
+
+	while (coremap[index].state == FRAME_BUSY_OUT)
+	{
+		wchan_sleep(FRAME_WCHAN(index), FRAME_LOCK(index));
+		waited = 1;
+	}
+
+	return waited;
+}
+
+//Imposta la entry della page table di (as, vaddr) sul frame index. Chiamata con il lock del frame
+static void coremap_setpte(int index, struct addrspace *as, vaddr_t vaddr)
+{
+	struct entry *e;
+
+	e = get_pt_entry(vaddr, as);
+	KASSERT(e != NULL);
+	e->paddr = (paddr_t)index * PAGE_SIZE;
+	e->valid_bit = 1;
+}
+
+/*
+ * Aggiunge un mapping (as, vaddr) al frame paddr, già in uso da un altro addrspace, e lo scrive nella page table
+ * di as: reverse map e page table cambiano insieme, così una eviction vede entrambi o nessuno dei due.
+ * Ritorna EAGAIN se il frame è appena finito nello swapfile (il chiamante deve rileggere la entry di origine)
+ */
+int coremap_share(paddr_t paddr, struct addrspace *as, vaddr_t vaddr)
+{
+	int index = paddr / PAGE_SIZE;
+	int result;
+
+	KASSERT(nRamFrames > index);
+
+	spinlock_acquire(FRAME_LOCK(index));
+	if (coremap_wait_out(index) || coremap[index].state == FRAME_BUSY_IN || coremap[index].state == FRAME_FREE)
+	{
+		spinlock_release(FRAME_LOCK(index));
+		return EAGAIN;
+	}
+	result = coremap_addmap(index, as, vaddr);
+	if (result == 0)
+	{
+		coremap_setpte(index, as, vaddr);
+	}
+	spinlock_release(FRAME_LOCK(index));
+
+	return result;
+}
+
+/*
+ * Toglie il mapping di as dal frame paddr. Il frame viene liberato (e tolto dalla page cache) quando non ha più mapping.
+ * Se il frame sta andando nello swapfile aspetta la fine dell'eviction, che ha già tolto il mapping: ritorna EAGAIN e
+ * la entry della page table punta ora allo slot, che il chiamante deve liberare
+ */
+int coremap_unshare(paddr_t paddr, struct addrspace *as)
+{
+	int index = paddr / PAGE_SIZE;
+	int last;
+
+	if (!isCoremapActive())
+		return 0;
+
+	KASSERT(nRamFrames > index);
+
+	spinlock_acquire(FRAME_LOCK(index));
+	if (coremap_wait_out(index))
+	{
+		spinlock_release(FRAME_LOCK(index));
+		return EAGAIN;
+	}
+	KASSERT(coremap[index].refcount > 0);
+	KASSERT(coremap[index].pincount == 0);
+
+	coremap[index].refcount--;
+	last = (coremap[index].refcount == 0);
+
+	if (!last)
+	{
+		coremap_dropmap(index, as);
+	}
+	else
+	{
+		if (coremap[index].pc_vnode != NULL)
+		{
+			pcache_unlink(index);
+		}
+		//senza mapping e fuori dalla page cache non può più essere scelto come vittima: freeppage_user lo toglie dalla coda
+		coremap[index].state = FRAME_FREE;
+	}
+	spinlock_release(FRAME_LOCK(index));
+	as_stats_pages(as, -1, 0);
+
+	if (last)
+		freeppage_user(paddr);
+
+	return 0;
+}
+
+//Ritorna 1 se il frame paddr è mappato da più di un addrspace
+int coremap_isshared(paddr_t paddr)
+{
+	int index = paddr / PAGE_SIZE;
+	int shared;
+
+	KASSERT(nRamFrames > index);
+
+	spinlock_acquire(FRAME_LOCK(index));
+	shared = (coremap[index].refcount > 1);
+	spinlock_release(FRAME_LOCK(index));
+
+	return shared;
+}
+
+//Cerca in page cache la pagina page del file v. Se c'è, la mappa anche in (as, vaddr), aggiornando la page table, e
+//ritorna il frame, altrimenti 0
+paddr_t pagecache_lookup(struct vnode *v, int page, struct addrspace *as, vaddr_t vaddr)
+{
+	paddr_t addr = 0;
+	int i;
+
+	if (!isCoremapActive())
+		return 0;
+
+	spinlock_acquire(&pcache_lock);
+	for (i = pcache[pcache_hash(v, page)]; i != -1; i = coremap[i].pc_next)
+	{
+		if (coremap[i].pc_vnode == v && coremap[i].pc_page == page)
+			break;
+	}
+	spinlock_release(&pcache_lock);
+
+	if (i == -1)
+		return 0;
+
+	//il lock del frame viene prima di pcache_lock: ricontrollo che il frame sia ancora in cache con la stessa pagina
+	spinlock_acquire(FRAME_LOCK(i));
+	if (coremap[i].pc_vnode == v && coremap[i].pc_page == page &&
+	    (coremap[i].state == FRAME_RESIDENT || coremap[i].state == FRAME_PINNED) &&
+	    coremap_addmap(i, as, vaddr) == 0)
+	{
+		//un frame in transito, o il pool della reverse map esaurito, vale come miss: il chiamante caricherà una copia
+		coremap_setpte(i, as, vaddr);
+		addr = (paddr_t)i * PAGE_SIZE;
+	}
+	spinlock_release(FRAME_LOCK(i));
+
+	return addr;
+}
+
+//Inserisce in page cache il frame paddr, appena riempito con la pagina page del file v
+void pagecache_insert(paddr_t paddr, struct vnode *v, int page)
+{
+	int index = paddr / PAGE_SIZE;
+	int h;
+
+	if (!isCoremapActive())
+		return;
+
+	KASSERT(nRamFrames > index);
+
+	spinlock_acquire(FRAME_LOCK(index));
+	KASSERT(coremap[index].pc_vnode == NULL);
+	h = pcache_hash(v, page);
+	spinlock_acquire(&pcache_lock);
+	coremap[index].pc_vnode = v;
+	coremap[index].pc_page = page;
+	coremap[index].pc_next = pcache[h];
+	pcache[h] = index;
+	spinlock_release(&pcache_lock);
+	spinlock_release(FRAME_LOCK(index));
+}
+
+//STATI DEI FRAME USER
+
+//Il frame paddr, appena allocato, è stato riempito dal nuovo proprietario: può essere scelto come vittima
+void coremap_ready(paddr_t paddr)
+{
+	int index = paddr / PAGE_SIZE;
+
+	if (!isCoremapActive())
+		return;
+
+	KASSERT(nRamFrames > index);
+
+	spinlock_acquire(FRAME_LOCK(index));
+	KASSERT(coremap[index].state == FRAME_BUSY_IN);
+	coremap[index].state = FRAME_RESIDENT;
+	wchan_wakeall(FRAME_WCHAN(index), FRAME_LOCK(index));
+	spinlock_release(FRAME_LOCK(index));
+}
+
+//Ritorna 1 se il frame paddr è in transito da o verso lo swapfile o il file ELF. Lettura senza lock, da ripetere sotto lock
+int coremap_isbusy(paddr_t paddr)
+{
+	int index = paddr / PAGE_SIZE;
+
+	KASSERT(nRamFrames > index);
+
+	return coremap[index].state == FRAME_BUSY_IN || coremap[index].state == FRAME_BUSY_OUT;
+}
+
+//Attende che il frame paddr non sia più in transito
+void coremap_wait(paddr_t paddr)
+{
+	int index = paddr / PAGE_SIZE;
+
+	KASSERT(nRamFrames > index);
+
+	spinlock_acquire(FRAME_LOCK(index));
+	while (coremap[index].state == FRAME_BUSY_IN || coremap[index].state == FRAME_BUSY_OUT)
+	{
+		wchan_sleep(FRAME_WCHAN(index), FRAME_LOCK(index));
+	}
+	spinlock_release(FRAME_LOCK(index));
+}
+
+/*
+ * Blocca in memoria il frame paddr, che non verrà scelto come vittima fino a coremap_unpin. Ritorna EAGAIN se il
+ * frame sta andando (o è appena andato) nello swapfile: il chiamante deve rileggere la entry della page table
+ */
+int coremap_pin(paddr_t paddr)
+{
+	int index = paddr / PAGE_SIZE;
+
+	KASSERT(nRamFrames > index);
+
+	spinlock_acquire(FRAME_LOCK(index));
+	if (coremap_wait_out(index) ||
+	    (coremap[index].state != FRAME_RESIDENT && coremap[index].state != FRAME_PINNED))
+	{
+		spinlock_release(FRAME_LOCK(index));
+		return EAGAIN;
+	}
+	coremap[index].state = FRAME_PINNED;
+	coremap[index].pincount++;
+	spinlock_release(FRAME_LOCK(index));
+
+	return 0;
+}
+
+void coremap_unpin(paddr_t paddr)
+{
+	int index = paddr / PAGE_SIZE;
+
+	KASSERT(nRamFrames > index);
+
+	spinlock_acquire(FRAME_LOCK(index));
+	KASSERT(coremap[index].state == FRAME_PINNED);
+	KASSERT(coremap[index].pincount > 0);
+	coremap[index].pincount--;
+	if (coremap[index].pincount == 0)
+	{
+		coremap[index].state = FRAME_RESIDENT;
+		wchan_wakeall(FRAME_WCHAN(index), FRAME_LOCK(index));
+	}
+	spinlock_release(FRAME_LOCK(index));
+}
+
+/*
+ * Blocca ogni modifica ai frame user, eviction comprese, prendendo tutti i frame lock in ordine crescente. Serve a
+ * sostituire un vettore di entry della page table che una eviction potrebbe aggiornare (as_sbrk). Operazione rara:
+ * nessun altro percorso tiene più di un frame lock alla volta
+ */
+void coremap_freeze(void)
+{
+	int i;
+
+	for (i = 0; i < FRAME_LOCKS; i++)
+	{
+		spinlock_acquire(&frame_lock[i]);
+	}
+}
+
+void coremap_thaw(void)
+{
+	int i;
+
+	for (i = FRAME_LOCKS - 1; i >= 0; i--)
+	{
+		spinlock_release(&frame_lock[i]);
+	}
+}
+
+//CODA FIFO DEI FRAME USER
+
+//Toglie il frame index dalla coda FIFO. Chiamata con victim_lock
+static void fifo_remove(int index)
+{
+	int prev = coremap[index].prevAllocated;
+	int next = coremap[index].nextAllocated;
+
+	if (prev != -1)
+		coremap[prev].nextAllocated = next;
+	else
+		head = next;
+	if (next != -1)
+		coremap[next].prevAllocated = prev;
+	else
+		tail = prev;
+
+	coremap[index].prevAllocated = -1;
+	coremap[index].nextAllocated = -1;
+}
+
+//Aggiunge il frame index in fondo alla coda FIFO. Chiamata con victim_lock
+static void fifo_append(int index)
+{
+	coremap[index].prevAllocated = tail;
+	coremap[index].nextAllocated = -1;
+	if (tail != -1)
+		coremap[tail].nextAllocated = index;
+	else
+		head = index;
+	tail = index;
+}
+
+/*
+ * Sceglie la vittima: il primo frame della coda FIFO che non è in transito né bloccato. Il frame passa in BUSY_OUT
+ * (i mapping restano nella page table, ma chi ne ha bisogno aspetta la fine dell'eviction), esce dalla TLB e va in
+ * fondo alla coda, dove resterà con il nuovo proprietario. Lo stato di ogni candidato si legge con il suo frame lock.
+ * Le invalidazioni per le altre CPU finiscono nel batch b.
+ */
+static int coremap_pick_victim(struct tlb_batch *b)
+{
+	int victim;
+
+	spinlock_acquire(&victim_lock);
+	for (;;)
+	{
+		for (victim = head; victim != -1; victim = coremap[victim].nextAllocated)
+		{
+			spinlock_acquire(FRAME_LOCK(victim));
+			if (coremap[victim].state == FRAME_RESIDENT)
+				break;
+			spinlock_release(FRAME_LOCK(victim));
+		}
+		if (victim != -1)
+			break;
+
+		if (head == -1)
+		{
+			panic("Out of memory: no user frame to evict\n");
+		}
+
+		//tutti i frame user sono in transito o bloccati: aspetto che cambi stato il primo della coda
+		victim = head;
+		spinlock_acquire(FRAME_LOCK(victim));
+		spinlock_release(&victim_lock);
+		if (coremap[victim].state != FRAME_RESIDENT)
+		{
+			wchan_sleep(FRAME_WCHAN(victim), FRAME_LOCK(victim));
+		}
+		spinlock_release(FRAME_LOCK(victim));
+		spinlock_acquire(&victim_lock);
+	}
+
+	KASSERT(coremap[victim].allocSize == 1);
+	KASSERT(coremap[victim].as != NULL);
+
+	coremap[victim].state = FRAME_BUSY_OUT;
+	coremap_tlb_invalid(victim, b);
+	spinlock_release(FRAME_LOCK(victim));
+
+	fifo_remove(victim);
+	fifo_append(victim);
+	spinlock_release(&victim_lock);
+
+	return victim;
+}
+
 //ALLOCAZIONE PER I PROCESSI USER (1 PAGINA)
 
-static paddr_t getppage_user(vaddr_t proc_vaddr){
-	struct addrspace *as;
+/*
+ * Il frame ritornato è in BUSY_IN: il chiamante lo riempie (swapin, file ELF, zeri o copia) e poi chiama
+ * coremap_ready. Fino ad allora non può essere scelto come vittima.
+ */
+static paddr_t getppage_user(struct addrspace *as, vaddr_t proc_vaddr, int *prezeroed){
 	paddr_t addr;
-	int last_alloc, victim, newvictim, swap_index;
-	struct entry *victim_entry;
+	int index, swap_index;
+	struct tlb_batch batch;
+	struct timespec before, after, duration;
+	uint64_t start;
 
-	as=proc_getas();  //ritorna addrspace del processo corrente
 	KASSERT(as != NULL); //getppage non può essere chiamata prima che la VM sia stata inizializzata
 
 	KASSERT((proc_vaddr & PAGE_FRAME) == proc_vaddr); //l'indirizzo virtuale deve essere quello di inizio di una pagina
 
-	addr= getfreeppages(1,as,proc_vaddr); //cerco una pagina libera nei frame liberati
+	start = vmlat_start();
+	addr = 0;
+	if (prezeroed != NULL)
+	{
+		//il chiamante vuole una pagina azzerata: prima la lista dei frame già azzerati
+		addr = getzeroedppage(as, proc_vaddr);
+		*prezeroed = (addr != 0);
+	}
+	if (addr == 0)
+		addr= getfreeppages(1,as,proc_vaddr); //cerco una pagina libera nei frame liberati
 
 	if (addr == 0)
 	{
@@ -213,171 +1002,196 @@ static paddr_t getppage_user(vaddr_t proc_vaddr){
 		spinlock_release(&stealmem_lock);
 	}
 
-	if(isCoremapActive()){ //aggiornamento Coremap
-		//leggo gli indici senza andare in conflitto. Ci lavoro. Li riaggiornerò dopo con un altro lock, senza dover mettere tutto in lock durante le operazioni.
+	if (!isCoremapActive())
+		return addr;
+
+	//Se ha trovato spazio nella RAM
+	if (addr != 0)
+	{
+		index = addr / PAGE_SIZE;
+
+		spinlock_acquire(FRAME_LOCK(index));
+		spinlock_acquire(&coremap_lock);
+		coremap[index].occupied = 1;
+		coremap[index].freed = 0;
+		coremap[index].allocSize = 1;
+		spinlock_release(&coremap_lock);
+		coremap[index].as = as;
+		coremap[index].vaddr = proc_vaddr;
+		coremap[index].refcount = 1;
+		coremap[index].state = FRAME_BUSY_IN;
+		spinlock_release(FRAME_LOCK(index));
+		as_stats_pages(as, 1, 0);
+
 		spinlock_acquire(&victim_lock);
-		last_alloc = tail;
-		victim = head;
+		fifo_append(index);
 		spinlock_release(&victim_lock);
 
-		//Se ha trovato spazio nella RAM
-		if(addr!=0){ 
-			spinlock_acquire(&coremap_lock);
-			int index = (addr / PAGE_SIZE);
-			coremap[index].occupied = 1;
-			coremap[index].freed=0;
-			coremap[index].allocSize = 1;
-			coremap[index].as = as;
-			coremap[index].vaddr = proc_vaddr;
-			
-			if(last_alloc!=-1){
-				//si è già allocata una pagina, si collega alle altre aggiornando la linkedlist
-				coremap[last_alloc].nextAllocated=index;
-				coremap[index].prevAllocated=last_alloc;
-				coremap[index].nextAllocated=-1;
-			}else{
-				coremap[index].prevAllocated=-1;
-				coremap[index].nextAllocated=-1;
-			}
-			spinlock_release(&coremap_lock);
+		vmlat_record(VMLAT_GETPPAGE, start);
+		return addr;
+	}
 
-			//aggiornamento FIFO head e tail
-			spinlock_acquire(&victim_lock);
-			if (victim == -1) //prima pagina
-				head = index;
-			tail = index;
-			spinlock_release(&victim_lock);
+	//Se non c'è più spazio in RAM - Salvo vittima in Swap (marcando indexSwap e aggiornando validBit PT) e ritorno paddr ram libero
+	gettime(&before);
+	tlb_batch_init(&batch);
+	index = coremap_pick_victim(&batch);
+	addr = (paddr_t)index * PAGE_SIZE;
 
-		}else{
-			//Se non c'è più spazio in RAM - Salvo vittima in Swap (marcando indexSwap e aggiornando validBit PT) e ritorno paddr ram libero
+	//prima di scrivere la vittima nessuna CPU deve poterla ancora modificare attraverso la sua TLB
+	tlb_shootdown_send(&batch);
+	gettime(&after);
+	timespec_sub(&after, &before, &duration);
+	vmstats_evict(duration.tv_sec * 1000000000ULL + duration.tv_nsec);
 
-			//****SWAP
-			addr = (paddr_t)victim * PAGE_SIZE; //paddr della vittima da spostare nello swapfile
-			swap_index = swapout(addr);
+	//La vittima è in BUSY_OUT: nessuno la modifica o la rilascia durante la scrittura, fatta senza lock.
+	//Le pagine di codice in page cache non vanno nello swapfile: verranno rilette dal file ELF
+	swap_index = -1;
+	if (coremap[index].pc_vnode == NULL)
+	{
+		swap_index = swapout(addr);
+		vmstats_increment(SWAPFILE_WRITES);
+	}
+	VMTRACE(VMT_EVICT, coremap[index].as, coremap[index].vaddr, addr, swap_index);
 
-			spinlock_acquire(&coremap_lock);
+	spinlock_acquire(FRAME_LOCK(index));
 
-			KASSERT(coremap[victim].allocSize == 1);
-			KASSERT(coremap[victim].as!=NULL);
+	//invalido la page table di tutti gli addrspace che mappano la vittima (più di uno se è condivisa)
+	coremap_unmap_all(index, swap_index);
 
-			//ottengo la entry della page table che dovrà essere spostata nello swapfile
-			victim_entry=get_pt_entry(coremap[victim].vaddr, coremap[victim].as);
-			KASSERT(victim_entry != NULL);
-			
-			//salvo l'index dello swapfile dove verrà memorizzata la pagina vittima
-			victim_entry->swapIndex=swap_index;
-			//invalido la entry della page table
-			victim_entry->valid_bit=0;
-			//invalido la entry nella tlb
-			tlb_invalid_one(addr);
+	//aggiornamento coremap: il frame passa al nuovo proprietario
+	coremap[index].vaddr = proc_vaddr;
+	coremap[index].as = as;
+	coremap[index].refcount = 1;
+	coremap[index].state = FRAME_BUSY_IN;
+	wchan_wakeall(FRAME_WCHAN(index), FRAME_LOCK(index));
 
-			//aggiornamento coremap
-			coremap[victim].vaddr = proc_vaddr;
-			coremap[victim].as = as;
+	spinlock_release(FRAME_LOCK(index));
+	as_stats_pages(as, 1, 0);
 
-			newvictim=coremap[victim].nextAllocated;
+	vmlat_record(VMLAT_GETPPAGE, start);
+	return addr;
+}
 
-			//ultima allocazione, indice della vittima, che ora è riempito con la nuova pagina entrante
-			coremap[last_alloc].nextAllocated=victim;
-			coremap[victim].nextAllocated=-1;
-			coremap[victim].prevAllocated=last_alloc;
+//Toglie dalla coda e libera il frame user index. Chiamata con victim_lock e il lock del frame
+static void coremap_release(int index)
+{
+	fifo_remove(index);
+	spinlock_acquire(&coremap_lock);
+	coremap[index].allocSize = 0;
+	coremap_clear(index);
+	spinlock_release(&coremap_lock);
+}
 
-			spinlock_release(&coremap_lock);
+//libera una pagina user senza più mapping, togliendola dalla coda FIFO
+void freeppage_user(paddr_t paddr)
+{
+	int index = paddr / PAGE_SIZE;
 
-			spinlock_acquire(&victim_lock);
-			//aggiornamento vittima - testa e coda
-			KASSERT(newvictim != -1);
-			tail = victim;
-			head = newvictim;
-			spinlock_release(&victim_lock);
+	if (!isCoremapActive())
+		return;
 
-			vmstats_increment(SWAPFILE_WRITES);
-		}
-	}
-	return addr;
+	KASSERT(nRamFrames > index);
+	KASSERT(coremap[index].allocSize == 1);
+
+	spinlock_acquire(&victim_lock);
+	spinlock_acquire(FRAME_LOCK(index));
+	coremap_release(index);
+	spinlock_release(FRAME_LOCK(index));
+	spinlock_release(&victim_lock);
 }
 
-//libera una pagina user ed aggiorna la linked list della coremap
-void freeppage_user(paddr_t paddr)
+/*
+ * Teardown di un addrspace (as_destroy): rilascia i mapping di as sui frame delle entry entries[0..n-1] con una sola
+ * acquisizione di victim_lock per tutto il batch, invece che per ogni pagina come freeppage_user. I frame ancora
+ * usati da altri addrspace perdono solo il mapping, gli altri vengono tolti dalla coda FIFO (e dalla page cache) e
+ * liberati. Un frame che sta andando nello swapfile viene lasciato finire: la sua entry diventa non valida e punta
+ * allo slot, che il chiamante deve liberare.
+ */
+void coremap_release_batch(struct addrspace *as, struct entry **entries, int n)
 {
-	int last_alloc, victim;
+	int i, index;
 
-	if (isCoremapActive())
+	if (!isCoremapActive() || n == 0)
+		return;
+
+	spinlock_acquire(&victim_lock);
+	for (i = 0; i < n; i++)
 	{
-		int index = paddr / PAGE_SIZE;
+		index = entries[i]->paddr / PAGE_SIZE;
 		KASSERT(nRamFrames > index);
-		KASSERT(coremap[index].allocSize == 1);
 
-		//per gestione vittima - tiene in memoria le ultime pagine aggiunte
-		spinlock_acquire(&victim_lock);
-		last_alloc = tail;
-		victim= head;
-		spinlock_release(&victim_lock);
+		spinlock_acquire(FRAME_LOCK(index));
+		while (entries[i]->valid_bit && coremap[index].state == FRAME_BUSY_OUT)
+		{
+			spinlock_release(&victim_lock);
+			coremap_wait_out(index);
+			spinlock_release(FRAME_LOCK(index));
+			spinlock_acquire(&victim_lock);
+			spinlock_acquire(FRAME_LOCK(index));
+		}
 
-		//aggiornamento linked list
-		spinlock_acquire(&coremap_lock);
-		//se non ha elementi precedenti
-		if (coremap[index].prevAllocated == -1)
+		if (!entries[i]->valid_bit)
 		{
-			//se non ha elementi successivi
-			if (coremap[index].nextAllocated == -1)
-			{
-				//c'è solo un elemento, invalido indici di tail e head - non c'è più vittima, verrà tolta
-				victim = -1;
-				last_alloc = -1;
-			}
-			else
-			{
-				//ha elementi successivi (è solo la prima pagina)
-				KASSERT(index == victim);  //head
-				coremap[coremap[index].nextAllocated].prevAllocated = -1;
-				victim= coremap[index].nextAllocated; //aggiorno head
-			}
+			spinlock_release(FRAME_LOCK(index));
+			continue;
+		}
+
+		KASSERT(coremap[index].allocSize == 1);
+		KASSERT(coremap[index].refcount > 0);
+		KASSERT(coremap[index].pincount == 0);
+
+		coremap[index].refcount--;
+		if (coremap[index].refcount > 0)
+		{
+			coremap_dropmap(index, as);
 		}
 		else
 		{
-			//ha degli elementi precedenti
-
-			//non ha degli elementi successivi
-			if (coremap[index].nextAllocated == -1)
-			{
-				// è l'ultima pagina inserita della linked list
-				KASSERT(index == last_alloc);
-				coremap[coremap[index].prevAllocated].nextAllocated = -1;
-				//aggiornamento ultimo allocato - tail 
-				last_alloc = coremap[index].prevAllocated;
-			}
-			else
+			if (coremap[index].pc_vnode != NULL)
 			{
-				//in mezzo alla linked list
-				coremap[coremap[index].nextAllocated].prevAllocated = coremap[index].prevAllocated;
-				coremap[coremap[index].prevAllocated].nextAllocated = coremap[index].nextAllocated;
+				pcache_unlink(index);
 			}
+			coremap_release(index);
 		}
+		spinlock_release(FRAME_LOCK(index));
+	}
+	spinlock_release(&victim_lock);
+}
 
-		//elimino collegamenti della linked lista dalla entry da eliminare
-		coremap[index].nextAllocated = -1;
-		coremap[index].prevAllocated = -1;
+paddr_t alloc_upage(vaddr_t vaddr)
+{
+	paddr_t pa;
 
-		spinlock_release(&coremap_lock);
+	can_sleep();
+	pa = getppage_user(proc_getas(), vaddr, NULL);
 
-		//libero una pagina
-		freeppages(paddr, 1);
+	return pa;
+}
 
-		//aggiornamento finale FIFO tail e head, con lock
-		spinlock_acquire(&victim_lock);
-		head = victim;
-		tail= last_alloc;
-		spinlock_release(&victim_lock);
-	}
+//Come alloc_upage, ma il frame viene assegnato ad as invece che all'addrspace del processo corrente (es. il figlio in as_copy)
+paddr_t alloc_upage_as(struct addrspace *as, vaddr_t vaddr)
+{
+	paddr_t pa;
+
+	can_sleep();
+	pa = getppage_user(as, vaddr, NULL);
+
+	return pa;
 }
 
-paddr_t alloc_upage(vaddr_t vaddr)
+//Come alloc_upage, ma il frame ritornato è già azzerato: se possibile viene dalla lista dei frame azzerati dal ciclo idle.
+//*prezeroed (se prezeroed != NULL) dice se il frame veniva da quella lista
+paddr_t alloc_upage_zero(vaddr_t vaddr, int *prezeroed)
 {
 	paddr_t pa;
+	int fromlist;
 
 	can_sleep();
-	pa = getppage_user(vaddr);
+	pa = getppage_user(proc_getas(), vaddr, &fromlist);
+	if (!fromlist)
+		bzero((void *)PADDR_TO_KVADDR(pa), PAGE_SIZE);
+	if (prezeroed != NULL)
+		*prezeroed = fromlist;
 
 	return pa;
 }
\ No newline at end of file
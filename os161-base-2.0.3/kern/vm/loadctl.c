@@ -0,0 +1,217 @@
+#include <types.h>
+#include <lib.h>
+#include <cpu.h>
+#include <clock.h>
+#include <synch.h>
+#include <thread.h>
+#include <current.h>
+#include <proc.h>
+#include <addrspace.h>
+#include <vmstats.h>
+#include <loadctl.h>
+
+/*
+ * Controllo del carico contro il thrashing. Un thread del kernel misura ogni LC_PERIOD secondi il tempo
+ * speso a servire page fault non banali (zero-fill, ELF, swap, COW, dagli istogrammi di vmstats.c) rispetto
+ * al tempo totale delle CPU. Se la percentuale supera LC_THRASH_PCT sospende il processo con il working set
+ * più grande; quando il carico torna basso (o non resta nessun altro processo) riammette i sospesi, il primo
+ * sospeso per primo. Un processo sospeso si ferma al ritorno in user mode (loadctl_checkpoint), senza lock
+ * del kernel; le sue pagine, non più toccate, sono le prime a uscire con la sostituzione FIFO.
+ */
+
+static struct lock *lc_lock = NULL;   //protegge i campi sotto e la sveglia dei sospesi
+static struct cv *lc_cv = NULL;       //i processi sospesi aspettano qui la riammissione
+static int lc_enabled = 0;
+static int lc_thread = 0;             //thread di controllo già creato
+static unsigned lc_suspensions = 0;
+static unsigned lc_readmissions = 0;
+static unsigned lc_last_pct = 0;      //percentuale misurata all'ultimo controllo
+
+static const int lc_codes[] = { VMLAT_FAULT_ZERO, VMLAT_FAULT_ELF, VMLAT_FAULT_SWAP, VMLAT_FAULT_COW };
+
+//Tempo totale speso nei page fault non banali, su tutte le CPU
+static uint64_t loadctl_paging_ns(void)
+{
+    uint64_t ns = 0;
+    unsigned i;
+
+    for (i = 0; i < sizeof(lc_codes) / sizeof(lc_codes[0]); i++)
+    {
+        ns += vmlat_ns(lc_codes[i]);
+    }
+    return ns;
+}
+
+static unsigned loadctl_diskfaults(void)
+{
+    unsigned c[VMSTATS_NUM];
+
+    vmstats_get(c);
+    return c[PAGE_FAULTS_DISK];
+}
+
+//Riammette un processo sospeso (il primo sospeso), 0 se non ce ne sono. Da chiamare con lc_lock
+static pid_t loadctl_readmit(void)
+{
+    pid_t pid;
+
+    KASSERT(lock_do_i_hold(lc_lock));
+    pid = proc_readmit();
+    if (pid != 0)
+    {
+        lc_readmissions++;
+        cv_broadcast(lc_cv, lc_lock);
+    }
+    return pid;
+}
+
+static void loadctl_thread(void *ptr, unsigned long unused)
+{
+    uint64_t ns, last_ns, period_ns;
+    unsigned faults, last_faults, pct;
+    int calm = 0;
+    pid_t pid;
+
+    (void)ptr;
+    (void)unused;
+
+    last_ns = loadctl_paging_ns();
+    last_faults = loadctl_diskfaults();
+    period_ns = (uint64_t)LC_PERIOD * 1000000000ULL * cpu_count();
+
+    while (1)
+    {
+        clocksleep(LC_PERIOD);
+
+        ns = loadctl_paging_ns();
+        faults = loadctl_diskfaults();
+        //dopo un "vmlat reset" il totale riparte da zero: il periodo conta come tranquillo
+        pct = ns >= last_ns ? (unsigned)((ns - last_ns) * 100 / period_ns) : 0;
+        //la durata dei fault comprende le attese sul disco, sommate su tutti i processi: può superare il 100%
+        if (pct > 100)
+        {
+            pct = 100;
+        }
+        faults -= last_faults;
+        last_ns = ns;
+        last_faults += faults;
+
+        lock_acquire(lc_lock);
+        lc_last_pct = pct;
+        if (!lc_enabled)
+        {
+            lock_release(lc_lock);
+            continue;
+        }
+
+        if (pct >= LC_THRASH_PCT && faults >= LC_MIN_FAULTS)
+        {
+            calm = 0;
+            pid = proc_suspend_largest();
+            if (pid != 0)
+            {
+                lc_suspensions++;
+                kprintf("loadctl: paging %u%% of CPU time, %u disk faults: suspending pid %d\n",
+                        pct, faults, pid);
+            }
+        }
+        else if (pct < LC_RECOVER_PCT)
+        {
+            calm++;
+        }
+        else
+        {
+            calm = 0;
+        }
+
+        if (calm >= LC_RECOVER_SECS || proc_count_running() == 0)
+        {
+            pid = loadctl_readmit();
+            if (pid != 0)
+            {
+                kprintf("loadctl: paging %u%% of CPU time: readmitting pid %d\n", pct, pid);
+            }
+            calm = 0;
+        }
+        lock_release(lc_lock);
+    }
+}
+
+//Attiva o disattiva il controllo (comando loadctl del menu). Disattivandolo si riammettono tutti i sospesi
+int loadctl_enable(int on)
+{
+    int result;
+
+    if (lc_lock == NULL)
+    {
+        lc_lock = lock_create("loadctl");
+        lc_cv = cv_create("loadctl");
+        if (lc_lock == NULL || lc_cv == NULL)
+        {
+            panic("loadctl: cannot create lock and cv\n");
+        }
+    }
+
+    lock_acquire(lc_lock);
+    if (on && !lc_thread)
+    {
+        result = thread_fork("loadctl", NULL, loadctl_thread, NULL, 0);
+        if (result)
+        {
+            lock_release(lc_lock);
+            return result;
+        }
+        lc_thread = 1;
+    }
+    //la scelta del processo da sospendere usa il working set: il campionamento serve finché il controllo è attivo
+    if (on && !lc_enabled)
+    {
+        vm_ws_enable(1);
+    }
+    else if (!on && lc_enabled)
+    {
+        vm_ws_enable(0);
+    }
+    lc_enabled = on;
+    if (!on)
+    {
+        while (loadctl_readmit() != 0)
+        {
+        }
+    }
+    lock_release(lc_lock);
+
+    return 0;
+}
+
+void loadctl_status(void)
+{
+    if (lc_lock == NULL)
+    {
+        kprintf("loadctl: off\n");
+        return;
+    }
+
+    lock_acquire(lc_lock);
+    kprintf("loadctl: %s, paging %u%% of CPU time, %u suspensions, %u readmissions\n",
+            lc_enabled ? "on" : "off", lc_last_pct, lc_suspensions, lc_readmissions);
+    lock_release(lc_lock);
+}
+
+//Punto di sospensione, al ritorno in user mode da una trap (mips_trap): nessun lock del kernel è tenuto
+void loadctl_checkpoint(void)
+{
+    struct proc *p = curproc;
+
+    if (p->p_suspended == 0 || lc_lock == NULL)
+    {
+        return;
+    }
+
+    lock_acquire(lc_lock);
+    while (p->p_suspended != 0)
+    {
+        cv_wait(lc_cv, lc_lock);
+    }
+    lock_release(lc_lock);
+}
@@ -13,34 +13,61 @@
 #include <pt.h>
 #include <segments.h>
 
-struct entry* get_pt_entry(vaddr_t vaddr, struct addrspace *as) {
-    // Segmento code
-    vaddr_t vbase1 = as->page_table->code->v_base;
-    vaddr_t vtop1 = vbase1 + as->page_table->code->npages * PAGE_SIZE;
+//Ritorna il segmento che contiene vaddr, NULL se l'indirizzo non appartiene a nessun segmento
+struct segment* pt_get_segment(vaddr_t vaddr, struct addrspace *as) {
+    struct segment *segs[4];
+    int i;
+
+    segs[0] = as->page_table->code;
+    segs[1] = as->page_table->data;
+    segs[2] = as->page_table->stack; // crescita decrescente, ma le entry sono indicizzate da v_base
+    segs[3] = as->page_table->heap;  // può essere vuoto (npages == 0)
 
-    if (vaddr >= vbase1 && vaddr < vtop1) {
-        int index = (vaddr - vbase1) / PAGE_SIZE;
-        return &as->page_table->code->entries[index];
+    for (i = 0; i < 4; i++) {
+        if (vaddr >= segs[i]->v_base && vaddr - segs[i]->v_base < segs[i]->npages * PAGE_SIZE) {
+            return segs[i];
+        }
     }
 
-    // Segmento data
-    vaddr_t vbase2 = as->page_table->data->v_base;
-    vaddr_t vtop2 = vbase2 + as->page_table->data->npages * PAGE_SIZE;
+    // Nessun segmento trovato
+    return NULL;
+}
+
+struct entry* get_pt_entry(vaddr_t vaddr, struct addrspace *as) {
+    struct segment *seg;
 
-    if (vaddr >= vbase2 && vaddr < vtop2) {
-        int index = (vaddr - vbase2) / PAGE_SIZE;
-        return &as->page_table->data->entries[index];
+    seg = pt_get_segment(vaddr, as);
+    if (seg == NULL) {
+        return NULL;
     }
 
-    // Segmento stack (crescita decrescente)
-    vaddr_t stackbase = as->page_table->stack->v_base;
-    vaddr_t stacktop = stackbase + as->page_table->stack->npages * PAGE_SIZE;
+    return &seg->entries[(vaddr - seg->v_base) / PAGE_SIZE];
+}
 
-    if (vaddr >= stackbase && vaddr < stacktop) {
-        int index = (vaddr - stackbase) / PAGE_SIZE;
-        return &as->page_table->stack->entries[index];
-    }
+//Verifica la struttura della page table. Viene chiamata quando l'addrspace è completo, non ad ogni fault
+void pt_check(struct addrspace *as) {
+    KASSERT(as->page_table != NULL);
 
-    // Nessun segmento trovato
-    return NULL;
+    KASSERT(as->page_table->code != NULL);
+    KASSERT(as->page_table->data != NULL);
+    KASSERT(as->page_table->stack != NULL);
+    KASSERT(as->page_table->heap != NULL);
+
+    KASSERT(as->page_table->code->v_base!=0);
+    KASSERT(as->page_table->code->npages!=0);
+    KASSERT(as->page_table->code->entries!=NULL);
+
+    KASSERT(as->page_table->data->v_base!=0);
+    KASSERT(as->page_table->data->npages!=0);
+    KASSERT(as->page_table->data->entries!=NULL);
+
+    KASSERT(as->page_table->stack->v_base!=0);
+    KASSERT(as->page_table->stack->npages!=0);
+    KASSERT(as->page_table->stack->entries!=NULL);
+
+    //gli indirizzi logici di partenza dei segmenti devono essere allineati alla pagina
+    KASSERT((as->page_table->code->v_base & PAGE_FRAME) == as->page_table->code->v_base);
+    KASSERT((as->page_table->data->v_base & PAGE_FRAME) == as->page_table->data->v_base);
+    KASSERT((as->page_table->stack->v_base & PAGE_FRAME) == as->page_table->stack->v_base);
+    KASSERT((as->page_table->heap->v_base & PAGE_FRAME) == as->page_table->heap->v_base);
 }
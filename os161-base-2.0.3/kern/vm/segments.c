@@ -12,6 +12,8 @@
 #include <elf.h>
 #include <kern/fcntl.h>
 #include <vmstats.h>
+#include <pt.h>
+#include <coremap.h>
 
 static void zero_a_region(paddr_t paddr, size_t n) {
     // Azzeramento della regione di memoria fisica a partire da paddr
@@ -24,6 +26,7 @@ static int write_page(struct vnode *v, paddr_t paddr, int npage, int segment) {
     int result;
     struct iovec iov;
     struct uio ku;
+    paddr_t page_paddr = paddr; // inizio del frame: paddr si sposta se il segmento non inizia a inizio pagina
 
     // Leggi l'header dell'eseguibile
 	/*
@@ -133,6 +136,11 @@ static int write_page(struct vnode *v, paddr_t paddr, int npage, int segment) {
         }
     }
 
+    // Azzero la pagina solo se la lettura non la sovrascrive per intero (prima/ultima pagina del segmento)
+    if (paddr != page_paddr || filesz < PAGE_SIZE) {
+        zero_a_region(page_paddr, PAGE_SIZE);
+    }
+
     // Leggi il contenuto del segmento nel buffer di memoria fisica
     iov.iov_kbase = (void *)PADDR_TO_KVADDR(paddr);
     iov.iov_len = memsz;
@@ -160,12 +168,141 @@ static int write_page(struct vnode *v, paddr_t paddr, int npage, int segment) {
 int load_page(struct addrspace* as, int npage, paddr_t paddr, int segment) {
     int result;
 
-    zero_a_region(paddr, PAGE_SIZE);  // Azzeramento della pagina
+    // L'azzeramento, dove serve, lo fa write_page: le pagine lette per intero dal file non vanno azzerate
+    // In caso di errore il file resta aperto: il riferimento è dell'addrspace (e dei processi che lo condividono
+    // dopo una fork), lo chiude as_destroy
     result = write_page(as->vfile, paddr, npage, segment);  // Scrittura della pagina nel segmento
     if (result) {
-        vfs_close(as->vfile);  // Chiusura del file se c'è stato un errore
         return result;
     }
 
     return 0;
 }
+
+//Legge len byte del file v a partire da offset, distribuendoli sugli niov buffer di iov
+static int read_run(struct vnode *v, struct iovec *iov, int niov, off_t offset, size_t len)
+{
+    struct uio ku;
+    int result;
+
+    if (niov == 0) return 0;
+
+    ku.uio_iov = iov;
+    ku.uio_iovcnt = niov;
+    ku.uio_offset = offset;
+    ku.uio_resid = len;
+    ku.uio_segflg = UIO_SYSSPACE;
+    ku.uio_rw = UIO_READ;
+    ku.uio_space = NULL;
+
+    result = VOP_READ(v, &ku);
+    if (result) return result;
+    if (ku.uio_resid != 0) {
+        kprintf("ELF: short read on segment - file truncated?\n");
+        return ENOEXEC;
+    }
+
+    return 0;
+}
+
+/*
+ * Carica subito (senza aspettare i fault) tutte le pagine di un segmento ELF. Il contenuto del file viene letto
+ * con una sola VOP_READ che distribuisce i dati sui frame del segmento, senza rileggere header e program header
+ * per ogni pagina come fa write_page. Le pagine non coperte interamente dal file vengono azzerate.
+ * segment vale 0 per il segmento di codice e 1 per quello dati, come in load_page. Le pagine di codice già
+ * in page cache vengono condivise invece che rilette: in quel caso la lettura si spezza in più VOP_READ.
+ */
+int load_segment_eager(struct addrspace *as, struct vnode *v, int segment, off_t offset, vaddr_t vaddr, size_t memsz, size_t filesz)
+{
+    struct iovec iov[PREFAULT_MAXPAGES];
+    bool shared[PREFAULT_MAXPAGES];
+    struct segment *seg;
+    struct entry *e;
+    vaddr_t page, first, fileend, start, end;
+    paddr_t paddr;
+    off_t runoff;
+    size_t runlen;
+    int niov, npages, i, idx, result;
+
+    if (filesz > memsz) {
+        kprintf("ELF: warning: segment filesize > segment memsize\n");
+        filesz = memsz;
+    }
+
+    first = vaddr & PAGE_FRAME;
+    fileend = vaddr + filesz;
+    npages = (vaddr + memsz - first + PAGE_SIZE - 1) / PAGE_SIZE;
+
+    seg = (segment == 0) ? as->page_table->code : as->page_table->data;
+    KASSERT(first >= seg->v_base && first + npages * PAGE_SIZE <= seg->v_base + seg->npages * PAGE_SIZE);
+    KASSERT(npages <= PREFAULT_MAXPAGES);
+
+    niov = 0;
+    runoff = 0;
+    runlen = 0;
+    for (i = 0; i < npages; i++) {
+        page = first + i * PAGE_SIZE;
+        idx = (page - seg->v_base) / PAGE_SIZE;
+        e = &seg->entries[idx];
+        KASSERT(e->valid_bit == 0 && e->swapIndex == -1);
+
+        // In caso di errore as_destroy libera anche i frame di questo segmento: li marco subito validi
+        e->valid_bit = 1;
+        vmstats_increment(PAGES_PREFAULTED);
+
+        shared[i] = 0;
+        if (segment == 0) {
+            paddr = pagecache_lookup(v, idx, as, page); // aggiorna anche la entry
+            if (paddr != 0) {
+                // Pagina già caricata da un altro processo: chiudo la lettura in corso e condivido il frame
+                result = read_run(v, iov, niov, runoff, runlen);
+                if (result) return result;
+                niov = 0;
+                runlen = 0;
+
+                shared[i] = 1;
+                vmstats_increment(PAGECACHE_HITS);
+                continue;
+            }
+        }
+
+        paddr = alloc_upage(page);
+        KASSERT((paddr & PAGE_FRAME) == paddr);
+        e->paddr = paddr;
+
+        // Azzero solo le pagine che il file non sovrascrive per intero (prima/ultima pagina e .bss)
+        if (page < vaddr || page + PAGE_SIZE > fileend) {
+            zero_a_region(paddr, PAGE_SIZE);
+        }
+
+        if (page < fileend) {
+            start = (page < vaddr) ? vaddr : page;
+            end = (page + PAGE_SIZE < fileend) ? page + PAGE_SIZE : fileend;
+            if (niov == 0) {
+                runoff = offset + (start - vaddr);
+            }
+            iov[niov].iov_kbase = (void *)(PADDR_TO_KVADDR(paddr) + (start - page));
+            iov[niov].iov_len = end - start;
+            runlen += end - start;
+            niov++;
+        }
+    }
+
+    result = read_run(v, iov, niov, runoff, runlen);
+    if (result) return result;
+
+    // Le pagine di codice lette dal file entrano in page cache solo quando il contenuto è completo.
+    // Da qui i frame caricati possono essere scelti come vittime
+    for (i = 0; i < npages; i++) {
+        if (!shared[i]) {
+            page = first + i * PAGE_SIZE;
+            idx = (page - seg->v_base) / PAGE_SIZE;
+            if (segment == 0) {
+                pagecache_insert(seg->entries[idx].paddr, v, idx);
+            }
+            coremap_ready(seg->entries[idx].paddr);
+        }
+    }
+
+    return 0;
+}
@@ -5,6 +5,7 @@
 #include <uio.h>
 #include <vm.h>
 #include <swapfile.h>
+#include <vmstats.h>
 #include <bitmap.h>
 
 static struct spinlock swap_lock = SPINLOCK_INITIALIZER;
@@ -16,6 +17,12 @@ static struct vnode *swapfile;
 //Tenere conto di quale pagine dello swapfile sono occupate
 static struct bitmap *swapfilemap;
 
+//Numero di pagine dello swapfile attualmente libere
+static unsigned int swap_nfree = 0;
+
+//Numero di page table entry che puntano ad ogni pagina dello swapfile (>1 dopo una fork)
+static unsigned short *swap_refcount;
+
 int swapfile_init(){
     int open;
     char path[32];
@@ -27,6 +34,13 @@ int swapfile_init(){
     }
 
     swapfilemap= bitmap_create(SWAPFILE_SIZE/PAGE_SIZE);
+    swap_nfree = SWAPFILE_SIZE/PAGE_SIZE;
+
+    swap_refcount = kmalloc((SWAPFILE_SIZE/PAGE_SIZE) * sizeof(unsigned short));
+    if (swapfilemap == NULL || swap_refcount == NULL) {
+        panic("swapfile.c : Impossibile allocare la bitmap dello swapfile\n");
+    }
+    bzero(swap_refcount, (SWAPFILE_SIZE/PAGE_SIZE) * sizeof(unsigned short));
     return 0;
 }
 
@@ -37,6 +51,7 @@ int swapout(paddr_t paddr ){ //"dalla ram allo swapfile (disco)"
     int result;
     unsigned int index; //indice della bitmap dove verrà salvato
     off_t free_offset;
+    uint64_t start;
 
     KASSERT(paddr != 0);
     KASSERT((paddr & PAGE_FRAME) == paddr);
@@ -46,8 +61,11 @@ int swapout(paddr_t paddr ){ //"dalla ram allo swapfile (disco)"
     if (result) {
         panic("swapfile.c : Non c'è abbastanza spazio nello swapfile\n");
     }
+    swap_nfree--;
+    swap_refcount[index] = 1;
     spinlock_release(&swap_lock);
 
+    start = vmlat_start();
     free_offset=index*PAGE_SIZE;
 
     uio_kinit(&iov, &u, (void *) PADDR_TO_KVADDR(paddr), PAGE_SIZE, free_offset, UIO_WRITE);
@@ -57,11 +75,13 @@ int swapout(paddr_t paddr ){ //"dalla ram allo swapfile (disco)"
     }
 
     KASSERT(index<(SWAPFILE_SIZE/PAGE_SIZE));
+    vmlat_record(VMLAT_SWAPOUT, start);
 
     return index;
 }
 
-int swapin(int swapIndex, paddr_t paddr){ //"dallo swapfile alla ram"
+//Legge nel frame paddr la pagina salvata in swapIndex, senza liberarla (la pagina resta anche nello swapfile)
+static int swap_read(int swapIndex, paddr_t paddr){
     off_t offset;
     struct iovec iov;
     struct uio u;
@@ -84,13 +104,33 @@ int swapin(int swapIndex, paddr_t paddr){ //"dallo swapfile alla ram"
         panic("swapfile.c : Impossibile leggere dallo swapfile all'indirizzo %u\n", paddr);
     }
 
-    spinlock_acquire(&swap_lock);
-    bitmap_unmark(swapfilemap, swapIndex); //setta a 0 il bit
-    spinlock_release(&swap_lock);
+    return 0;
+}
+
+//Legge la pagina in paddr e rilascia il riferimento allo slot: se è condiviso con altri processi resta occupato
+int swapin(int swapIndex, paddr_t paddr){ //"dallo swapfile alla ram"
+    uint64_t start = vmlat_start();
+
+    swap_read(swapIndex, paddr);
+    swap_free(swapIndex);
+    vmlat_record(VMLAT_SWAPIN, start);
 
     return 0;
 }
 
+//Un'altra page table entry (es. del figlio in una fork) punta allo slot indexSwap
+void swap_share(int indexSwap) {
+    KASSERT(indexSwap >= 0 && indexSwap < SWAPFILE_SIZE/PAGE_SIZE);
+
+    spinlock_acquire(&swap_lock);
+    if (!bitmap_isset(swapfilemap, indexSwap)) {
+        panic("swapfile.c: Errore: condivisione di una pagina dello swapfile vuota\n");
+    }
+    KASSERT(swap_refcount[indexSwap] < 0xffff);
+    swap_refcount[indexSwap]++;
+    spinlock_release(&swap_lock);
+}
+
 void swap_free(int indexSwap) {
     off_t offset;
 
@@ -104,9 +144,46 @@ void swap_free(int indexSwap) {
         panic("swapfile.c: Errore:Impossibile libera pagina dello swapfile già vuota\n");
     }
 
-    //setta il bit a 0
-    bitmap_unmark(swapfilemap, indexSwap);
+    //lo slot si libera solo quando non ci sono più page table entry che lo usano
+    KASSERT(swap_refcount[indexSwap] > 0);
+    swap_refcount[indexSwap]--;
+    if (swap_refcount[indexSwap] == 0) {
+        //setta il bit a 0
+        bitmap_unmark(swapfilemap, indexSwap);
+        swap_nfree++;
+    }
+    spinlock_release(&swap_lock);
+}
+
+//Rilascia gli n slot di slots con una sola acquisizione di swap_lock (teardown di un addrspace)
+void swap_free_batch(int *slots, int n) {
+    int i;
+
+    spinlock_acquire(&swap_lock);
+    for (i = 0; i < n; i++) {
+        KASSERT(slots[i] >= 0 && slots[i] < SWAPFILE_SIZE/PAGE_SIZE);
+        if (!bitmap_isset(swapfilemap, slots[i])) {
+            panic("swapfile.c: Errore:Impossibile libera pagina dello swapfile già vuota\n");
+        }
+        KASSERT(swap_refcount[slots[i]] > 0);
+        swap_refcount[slots[i]]--;
+        if (swap_refcount[slots[i]] == 0) {
+            bitmap_unmark(swapfilemap, slots[i]);
+            swap_nfree++;
+        }
+    }
+    spinlock_release(&swap_lock);
+}
+
+//Ritorna il numero di pagine libere nello swapfile
+int swap_freeslots(void) {
+    unsigned int nfree;
+
+    spinlock_acquire(&swap_lock);
+    nfree = swap_nfree;
     spinlock_release(&swap_lock);
+
+    return (int)nfree;
 }
 
 void swap_shutdown(void) {
@@ -115,4 +192,5 @@ void swap_shutdown(void) {
 
     vfs_close(swapfile);
     bitmap_destroy(swapfilemap);
+    kfree(swap_refcount);
 }
\ No newline at end of file
@@ -1,80 +1,776 @@
-#include <spl.h>
 #include <types.h>
+#include <lib.h>
+#include <spl.h>
+#include <spinlock.h>
+#include <cpu.h>
+#include <current.h>
 #include <mips/tlb.h>
+#include <addrspace.h>
 #include <vm_tlb.h>
 #include <vmstats.h>
 
-static int tlb_get_rr_victim(void)
+/*
+ * ASID: ogni addrspace riceve un identificatore di 6 bit (da 1 a NUM_ASID-1: 0 non viene assegnato, le entry
+ * invalide hanno PID 0) con cui sono marcate le sue entry nella TLB, così cambiare contesto non richiede di svuotarla.
+ * Gli ASID sono globali e assegnati in sequenza; quando finiscono inizia una nuova generazione: un addrspace con
+ * ASID di una generazione precedente ne riceve uno nuovo alla prossima attivazione, e ogni CPU svuota la propria
+ * TLB la prima volta che attiva un addrspace della nuova generazione.
+ *
+ * Per ogni CPU: l'addrspace attivo (un thread del kernel lascia quello del processo precedente), il suo ASID, la
+ * generazione degli ASID presenti nella TLB e il proprietario di ciascuno. Ogni CPU modifica solo il proprio
+ * elemento: gli shootdown delle altre CPU li esegue lei stessa nell'interrupt. as->tlb_cpumask indica le CPU la cui
+ * TLB può contenere entry dell'addrspace (un bit per CPU, quelle per cui owner lo contiene).
+ */
+#define TLB_HASH 256
+
+/*
+ * TLB software: per ogni CPU una cache direct-mapped di STLB_SIZE traduzioni (ASID, pagina) -> (frame, permessi),
+ * riempita a ogni scrittura nella TLB. Un tlb miss che la trova non cerca nella page table. È invalidata insieme
+ * alla TLB (la stessa pagina, lo stesso intervallo, lo stesso addrspace, tutto), quindi resta coerente con eviction e
+ * shootdown. Le entry di un addrspace distrutto restano ma non vengono più cercate: il suo ASID tornerà in uso solo
+ * dopo un rollover, che svuota anche la TLB software. ehi = 0 (PID 0, mai assegnato) indica una entry vuota.
+ */
+#define STLB_SIZE 1024
+
+struct stlb_entry {
+    uint32_t ehi;
+    uint32_t elo;
+};
+
+struct tlb_cpu {
+    struct cpu *cpu;
+    struct addrspace *as;
+    unsigned asid;
+    uint32_t gen;
+    struct addrspace *owner[NUM_ASID];
+
+    //gestione degli slot, vedi tlb_get_victim
+    uint64_t freemask;              //slot liberi (entry invalide), un bit per slot
+    uint32_t epoch;                 //numero di tlb fault della CPU
+    uint32_t slot_epoch[NUM_TLB];   //epoch dell'inserimento (o dell'ultimo aggiornamento) di ogni slot
+
+    //copia del contenuto della TLB: EntryHi di ogni slot occupato e numero di slot occupati per valore di hash
+    //di EntryHi. Se il contatore è 0 la pagina non è nella TLB e non serve interrogarla con tlb_probe
+    uint32_t shadow[NUM_TLB];
+    uint8_t hcount[TLB_HASH];
+
+    struct stlb_entry *stlb;        //TLB software, NULL finché stlb_setup non l'ha allocata
+};
+
+#define TLB_ALLFREE (~(uint64_t)0 >> (64 - NUM_TLB))
+#define TLB_RECENT 4 //le entry inserite negli ultimi TLB_RECENT tlb fault non vengono rimpiazzate
+
+static struct tlb_cpu tlb_cpus[TLB_MAXCPUS];
+static struct spinlock asid_lock = SPINLOCK_INITIALIZER; //asid_gen, asid_next e tlb_cpumask degli addrspace
+static uint32_t asid_gen = 1;
+static unsigned asid_next = 1;
+static struct spinlock tlb_ack_lock = SPINLOCK_INITIALIZER; //contatori pending dei batch in corso
+
+//Ripristina in EntryHi l'ASID attivo, sovrascritto dalle scritture di entry invalide e da tlb_read. Chiamata a spl alto
+static void tlb_restore_asid(void)
 {
-    int victim;
-    static unsigned int next_victim = 0;
-    victim = next_victim;
-    next_victim = (next_victim + 1) % NUM_TLB;
+    tlb_setasid(tlb_cpus[curcpu->c_number].asid);
+}
+
+static uint32_t tlb_make_ehi(vaddr_t vaddr, unsigned asid)
+{
+    return vaddr | (asid << TLBHI_PIDSHIFT);
+}
+
+//ASID con cui as ha entry nella TLB della CPU t, 0 se non ne ha. Chiamata a spl alto dalla CPU t
+static unsigned tlb_asid_of(struct tlb_cpu *t, struct addrspace *as)
+{
+    unsigned k;
+
+    if (as->tlb_asid != 0 && t->owner[as->tlb_asid] == as)
+    {
+        return as->tlb_asid;
+    }
+    //la TLB può avere ancora l'ASID di una generazione precedente
+    for (k = 1; k < NUM_ASID; k++)
+    {
+        if (t->owner[k] == as)
+        {
+            return k;
+        }
+    }
+    return 0;
+}
+
+//La CPU me non ha più entry con l'ASID k: toglie il proprietario. Chiamata con asid_lock
+static void tlb_drop_owner(unsigned me, unsigned k)
+{
+    struct tlb_cpu *t = &tlb_cpus[me];
+
+    t->owner[k]->tlb_cpumask &= ~((uint32_t)1 << me);
+    t->owner[k] = NULL;
+}
+
+/*
+ * Sceglie lo slot della TLB della CPU t in cui scrivere una nuova entry: il primo slot libero se c'è, altrimenti
+ * quello con l'epoch più vecchia (approssimazione di LRU: l'epoch viene rinnovata quando la entry viene aggiornata),
+ * escluse le entry inserite negli ultimi TLB_RECENT fault, che servono all'istruzione appena rieseguita o al
+ * fault-around in corso. Chiamata a spl alto.
+ */
+static int tlb_get_victim(struct tlb_cpu *t)
+{
+    int i, victim;
+
+    if (t->freemask != 0)
+    {
+        for (i = 0; (t->freemask & ((uint64_t)1 << i)) == 0; i++);
+        return i;
+    }
+
+    victim = 0;
+    for (i = 0; i < NUM_TLB; i++)
+    {
+        if ((int32_t)(t->epoch - t->slot_epoch[i]) < TLB_RECENT)
+        {
+            continue;
+        }
+        if ((int32_t)(t->epoch - t->slot_epoch[victim]) < TLB_RECENT ||
+            (int32_t)(t->slot_epoch[i] - t->slot_epoch[victim]) < 0)
+        {
+            victim = i;
+        }
+    }
     return victim;
 }
 
-void tlb_insert(vaddr_t vaddr, paddr_t paddr, uint8_t readonly)
+static unsigned tlb_hash(uint32_t ehi)
 {
-    int spl;
-    int victim;
-    uint32_t ehi, elo;
+    return ((ehi >> 12) ^ (((ehi & TLBHI_PID) >> TLBHI_PIDSHIFT) * 37)) % TLB_HASH;
+}
 
-    spl = splhigh();
+static int tlb_slot_isfree(struct tlb_cpu *t, int i)
+{
+    return (t->freemask & ((uint64_t)1 << i)) != 0;
+}
+
+//Lo slot i contiene ora la entry ehi, con epoch epoch. Chiamata a spl alto
+static void tlb_slot_used(struct tlb_cpu *t, int i, uint32_t ehi, uint32_t epoch)
+{
+    if (!tlb_slot_isfree(t, i))
+    {
+        t->hcount[tlb_hash(t->shadow[i])]--;
+    }
+    t->shadow[i] = ehi;
+    t->hcount[tlb_hash(ehi)]++;
+    t->freemask &= ~((uint64_t)1 << i);
+    t->slot_epoch[i] = epoch;
+}
 
-    victim = tlb_get_rr_victim();
+//Scrive una entry invalida nello slot i, che torna libero. Chiamata a spl alto, poi va ripristinato l'ASID
+static void tlb_slot_free(struct tlb_cpu *t, int i)
+{
+    KASSERT(!tlb_slot_isfree(t, i));
+    t->hcount[tlb_hash(t->shadow[i])]--;
+    tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+    t->freemask |= (uint64_t)1 << i;
+}
 
-    tlb_read(&ehi, &elo, victim);
-    if(elo & TLBLO_VALID)
+//Slot che contiene la entry ehi, -1 se non è nella TLB: se la copia dice che manca, la TLB non viene interrogata.
+//Chiamata a spl alto
+static int tlb_lookup(struct tlb_cpu *t, uint32_t ehi)
+{
+    int i;
+
+    if (t->hcount[tlb_hash(ehi)] == 0)
     {
-        vmstats_increment(TLB_FAULTS_WITH_REPLACE);
+        return -1;
     }
-    else
+    i = tlb_probe(ehi, 0);
+    if ((ehi & TLBHI_PID) != (t->asid << TLBHI_PIDSHIFT))
     {
-        vmstats_increment(TLB_FAULTS_WITH_FREE);
+        tlb_restore_asid();
+    }
+    return i;
+}
+
+static unsigned stlb_index(uint32_t ehi)
+{
+    return ((ehi >> 12) ^ (((ehi & TLBHI_PID) >> TLBHI_PIDSHIFT) << 4)) % STLB_SIZE;
+}
+
+//Copia nella TLB software la entry appena scritta nella TLB. Chiamata a spl alto
+static void stlb_fill(struct tlb_cpu *t, uint32_t ehi, uint32_t elo)
+{
+    struct stlb_entry *se;
+
+    if (t->stlb == NULL)
+    {
+        return;
     }
+    se = &t->stlb[stlb_index(ehi)];
+    se->ehi = ehi;
+    se->elo = elo;
+}
 
-    ehi = vaddr;
+//Toglie dalla TLB software le pagine con ASID asid in [start, end). Chiamata a spl alto
+static void stlb_invalid(struct tlb_cpu *t, unsigned asid, vaddr_t start, vaddr_t end)
+{
+    unsigned i;
+    uint32_t ehi;
+    vaddr_t vaddr;
 
+    if (t->stlb == NULL)
+    {
+        return;
+    }
+
+    if ((end - start) / PAGE_SIZE < STLB_SIZE)
+    {
+        //intervallo piccolo: una posizione per pagina
+        for (vaddr = start; vaddr < end; vaddr += PAGE_SIZE)
+        {
+            ehi = tlb_make_ehi(vaddr, asid);
+            if (t->stlb[stlb_index(ehi)].ehi == ehi)
+            {
+                t->stlb[stlb_index(ehi)].ehi = 0;
+            }
+        }
+        return;
+    }
+
+    for (i = 0; i < STLB_SIZE; i++)
+    {
+        ehi = t->stlb[i].ehi;
+        if (((ehi & TLBHI_PID) >> TLBHI_PIDSHIFT) == asid &&
+            (ehi & TLBHI_VPAGE) >= start && (ehi & TLBHI_VPAGE) < end)
+        {
+            t->stlb[i].ehi = 0;
+        }
+    }
+}
+
+//Alloca la TLB software della CPU corrente, se non ce l'ha ancora (senza, i tlb miss cercano nella page table). Può dormire
+void stlb_setup(void)
+{
+    struct stlb_entry *stlb;
+    struct tlb_cpu *t;
+    int spl;
+
+    if (tlb_cpus[curcpu->c_number].stlb != NULL)
+    {
+        return;
+    }
+
+    stlb = kmalloc(sizeof(struct stlb_entry) * STLB_SIZE);
+    if (stlb == NULL)
+    {
+        return;
+    }
+    bzero(stlb, sizeof(struct stlb_entry) * STLB_SIZE);
+
+    //kmalloc può aver dormito: il thread può essere su un'altra CPU, che magari ha già la sua
+    spl = splhigh();
+    t = &tlb_cpus[curcpu->c_number];
+    if (t->stlb == NULL)
+    {
+        t->stlb = stlb;
+        stlb = NULL;
+    }
+    splx(spl);
+
+    if (stlb != NULL)
+    {
+        kfree(stlb);
+    }
+}
+
+static uint32_t tlb_make_elo(paddr_t paddr, uint8_t readonly)
+{
     if(readonly == 1) // solo lettura
-        elo = paddr | TLBLO_VALID;
+        return paddr | TLBLO_VALID;
     else
-        elo = paddr | TLBLO_DIRTY | TLBLO_VALID;
+        return paddr | TLBLO_DIRTY | TLBLO_VALID;
+}
+
+//Scrive nella TLB la entry per un tlb fault e la copia nella TLB software. Chiamata a spl alto
+static void tlb_insert_fault(struct tlb_cpu *t, uint32_t ehi, uint32_t elo)
+{
+    int victim;
+
+    if(t->freemask != 0)
+    {
+        vmstats_increment(TLB_FAULTS_WITH_FREE);
+    }
+    else
+    {
+        vmstats_increment(TLB_FAULTS_WITH_REPLACE);
+    }
+
+    t->epoch++;
+    victim = tlb_get_victim(t);
 
     tlb_write(ehi, elo, victim);
+    tlb_slot_used(t, victim, ehi, t->epoch);
+    stlb_fill(t, ehi, elo);
+}
 
+//Le entry inserite sono dell'addrspace attivo sulla CPU e ne portano l'ASID
+void tlb_insert(vaddr_t vaddr, paddr_t paddr, uint8_t readonly)
+{
+    int spl;
+    struct tlb_cpu *t;
+
+    spl = splhigh();
+
+    t = &tlb_cpus[curcpu->c_number];
+    tlb_insert_fault(t, tlb_make_ehi(vaddr, t->asid), tlb_make_elo(paddr, readonly));
 
     splx(spl);
 }
 
+/*
+ * Tlb miss su vaddr dell'addrspace attivo: se la traduzione è nella TLB software la scrive nella TLB e ritorna 1,
+ * altrimenti ritorna 0 e va cercata nella page table. Come in vm_fault, il controllo e la scrittura avvengono senza
+ * interruzioni: uno shootdown che toglie la pagina arriva dopo e la toglie da entrambe.
+ */
+int tlb_reload_soft(vaddr_t vaddr)
+{
+    int spl, hit = 0;
+    uint32_t ehi;
+    struct tlb_cpu *t;
+    struct stlb_entry *se;
 
+    spl = splhigh();
+
+    t = &tlb_cpus[curcpu->c_number];
+    if (t->stlb != NULL)
+    {
+        ehi = tlb_make_ehi(vaddr, t->asid);
+        se = &t->stlb[stlb_index(ehi)];
+        if (se->ehi == ehi)
+        {
+            tlb_insert_fault(t, ehi, se->elo);
+            hit = 1;
+        }
+    }
+
+    splx(spl);
+    return hit;
+}
+
+/*
+ * Aggiorna la traduzione di vaddr già presente nella TLB (es. dopo la copia di una pagina copy-on-write),
+ * senza creare duplicati. Se la entry non c'è più viene inserita come in tlb_insert, ma senza statistiche:
+ * non è un tlb fault.
+ */
+void tlb_update(vaddr_t vaddr, paddr_t paddr, uint8_t readonly)
+{
+    int spl;
+    int index;
+    uint32_t ehi;
+    struct tlb_cpu *t;
+
+    spl = splhigh();
+
+    t = &tlb_cpus[curcpu->c_number];
+    ehi = tlb_make_ehi(vaddr, t->asid);
+    index = tlb_lookup(t, ehi);
+    if (index < 0)
+    {
+        index = tlb_get_victim(t);
+    }
+    tlb_write(ehi, tlb_make_elo(paddr, readonly), index);
+    tlb_slot_used(t, index, ehi, t->epoch);
+    stlb_fill(t, ehi, tlb_make_elo(paddr, readonly));
+
+    splx(spl);
+}
+
+/*
+ * Carica nella TLB una pagina vicina a quella del fault (fault-around). Non è un tlb fault, quindi
+ * non aggiorna TLB_FAULTS_WITH_FREE/REPLACE. La entry è speculativa: riceve un'epoch più vecchia di
+ * TLB_RECENT, così non è protetta come quelle appena inserite da un fault e viene rimpiazzata prima di loro.
+ * Ritorna 1 se la entry è stata inserita, 0 se la pagina era già nella TLB (non si devono avere duplicati).
+ */
+int tlb_preload(vaddr_t vaddr, paddr_t paddr, uint8_t readonly)
+{
+    int spl;
+    int victim;
+    uint32_t ehi;
+    struct tlb_cpu *t;
+
+    spl = splhigh();
+
+    t = &tlb_cpus[curcpu->c_number];
+    ehi = tlb_make_ehi(vaddr, t->asid);
+    if (tlb_lookup(t, ehi) >= 0)
+    {
+        splx(spl);
+        return 0;
+    }
+
+    victim = tlb_get_victim(t);
+    tlb_write(ehi, tlb_make_elo(paddr, readonly), victim);
+    tlb_slot_used(t, victim, ehi, t->epoch - TLB_RECENT);
+    stlb_fill(t, ehi, tlb_make_elo(paddr, readonly));
+
+    splx(spl);
+    return 1;
+}
+
+
+//Svuota la TLB e la TLB software della CPU corrente
 void tlb_invalid(void)
 {
     int i, spl;
+    struct tlb_cpu *t;
     spl = splhigh();
 
 	for (i=0; i<NUM_TLB; i++) {
 		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
 	}
+    t = &tlb_cpus[curcpu->c_number];
+    t->freemask = TLB_ALLFREE;
+    bzero(t->hcount, sizeof(t->hcount));
+    if (t->stlb != NULL)
+    {
+        bzero(t->stlb, sizeof(struct stlb_entry) * STLB_SIZE);
+    }
+    tlb_restore_asid();
 
 	splx(spl);
 }
 
-void tlb_invalid_one(paddr_t paddr)
+//Invalida la traduzione di vaddr con ASID asid, se è nella TLB. Ritorna 1 se c'era. Chiamata a spl alto
+static int tlb_invalid_page(vaddr_t vaddr, unsigned asid)
 {
-    int i, spl;
-    uint32_t ehi, elo;
+    struct tlb_cpu *t = &tlb_cpus[curcpu->c_number];
+    int i;
+
+    stlb_invalid(t, asid, vaddr, vaddr + PAGE_SIZE);
+    i = tlb_lookup(t, tlb_make_ehi(vaddr, asid));
+    if (i >= 0)
+    {
+        tlb_slot_free(t, i);
+        tlb_restore_asid();
+    }
+
+    return i >= 0;
+}
+
+/*
+ * Invalida le entry con ASID asid delle pagine in [start, end) (tutte con start = 0 e end = 0xffffffff) e ritorna
+ * quante erano. Cerca nella copia della TLB, senza leggerla. Chiamata a spl alto
+ */
+static int tlb_invalid_asid(unsigned asid, vaddr_t start, vaddr_t end)
+{
+    int i, n = 0;
+    uint32_t ehi;
+    struct tlb_cpu *t = &tlb_cpus[curcpu->c_number];
 
-    KASSERT((paddr & PAGE_FRAME) == paddr);
+    for (i = 0; i < NUM_TLB; i++)
+    {
+        if (tlb_slot_isfree(t, i))
+        {
+            continue;
+        }
+        ehi = t->shadow[i];
+        if (((ehi & TLBHI_PID) >> TLBHI_PIDSHIFT) == asid &&
+            (ehi & TLBHI_VPAGE) >= start && (ehi & TLBHI_VPAGE) < end)
+        {
+            tlb_slot_free(t, i);
+            n++;
+        }
+    }
+    if (n > 0)
+    {
+        tlb_restore_asid();
+    }
+
+    return n;
+}
+
+//Invalida la traduzione di vaddr dell'addrspace corrente, se è nella TLB. Ritorna 1 se c'era
+int tlb_invalid_vaddr(vaddr_t vaddr)
+{
+    int spl, found;
+
+    KASSERT((vaddr & PAGE_FRAME) == vaddr);
 
     spl = splhigh();
+    found = tlb_invalid_page(vaddr, tlb_cpus[curcpu->c_number].asid);
+    splx(spl);
 
-	for (i=0; i<NUM_TLB; i++) {
-        tlb_read(&ehi, &elo, i);
-        if((elo & PAGE_FRAME) == paddr)
+    return found;
+}
+
+/*
+ * Attiva as sulla CPU corrente (as_activate). La TLB viene svuotata solo se contiene ASID di una generazione
+ * precedente; le entry di as inserite in un'attivazione precedente restano valide.
+ */
+void tlb_activate(struct addrspace *as)
+{
+    int spl;
+    unsigned me, k;
+    struct tlb_cpu *t;
+
+    spl = splhigh();
+
+    me = curcpu->c_number;
+    KASSERT(me < TLB_MAXCPUS);
+    t = &tlb_cpus[me];
+    t->cpu = curcpu->c_self;
+
+    spinlock_acquire(&asid_lock);
+    if (as->tlb_gen != asid_gen)
+    {
+        if (asid_next == NUM_ASID)
         {
-		    tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+            //ASID finiti: nuova generazione
+            asid_gen++;
+            asid_next = 1;
+            vmstats_increment(ASID_ROLLOVERS);
         }
-	}
+        as->tlb_asid = asid_next++;
+        as->tlb_gen = asid_gen;
+    }
+    if (t->gen != asid_gen)
+    {
+        //gli ASID nella TLB possono essere stati riassegnati ad altri addrspace
+        for (k = 1; k < NUM_ASID; k++)
+        {
+            if (t->owner[k] != NULL)
+            {
+                tlb_drop_owner(me, k);
+            }
+        }
+        t->gen = asid_gen;
+        t->asid = 0;
+        tlb_invalid();
+        vmstats_increment(TLB_INVALIDATIONS);
+    }
+    t->owner[as->tlb_asid] = as;
+    as->tlb_cpumask |= (uint32_t)1 << me;
+    spinlock_release(&asid_lock);
 
-	splx(spl);
-}
\ No newline at end of file
+    t->as = as;
+    t->asid = as->tlb_asid;
+    tlb_setasid(t->asid);
+
+    splx(spl);
+}
+
+/*
+ * Esegue sulla CPU corrente uno shootdown (anche la parte locale di quelli spediti da questa CPU). Ritorna il numero
+ * di entry invalidate. Un addrspace invalidato per intero viene dimenticato, a meno che non sia quello attivo (che
+ * continuerà a inserire entry); se viene distrutto è dimenticato comunque. Chiamata a spl alto.
+ */
+static int tlb_do_shootdown(int op, struct addrspace *as, vaddr_t vaddr, vaddr_t end)
+{
+    unsigned me, k;
+    struct tlb_cpu *t;
+    int n = 0;
+
+    me = curcpu->c_number;
+    t = &tlb_cpus[me];
+
+    switch (op)
+    {
+    case TS_ALL:
+        tlb_invalid();
+        vmstats_increment(TLB_INVALIDATIONS);
+        break;
+    case TS_VADDR:
+        k = tlb_asid_of(t, as);
+        if (k != 0)
+        {
+            n = tlb_invalid_page(vaddr, k);
+        }
+        break;
+    case TS_RANGE:
+        k = tlb_asid_of(t, as);
+        if (k != 0)
+        {
+            n = tlb_invalid_asid(k, vaddr, end);
+            stlb_invalid(t, k, vaddr, end);
+        }
+        break;
+    case TS_AS:
+    case TS_FORGET:
+        k = tlb_asid_of(t, as);
+        if (k != 0)
+        {
+            n = tlb_invalid_asid(k, 0, 0xffffffff);
+            if (op == TS_AS)
+            {
+                //con TS_FORGET l'ASID non verrà più cercato, vedi STLB_SIZE
+                stlb_invalid(t, k, 0, 0xffffffff);
+            }
+            vmstats_increment(TLB_INVALIDATIONS);
+            if (op == TS_FORGET || t->as != as)
+            {
+                spinlock_acquire(&asid_lock);
+                tlb_drop_owner(me, k);
+                spinlock_release(&asid_lock);
+            }
+        }
+        if (op == TS_FORGET && t->as == as)
+        {
+            t->as = NULL;
+        }
+        break;
+    default:
+        panic("Unknown TLB shootdown %d\n", op);
+    }
+
+    return n;
+}
+
+//Esegue lo shootdown op di as su tutte le CPU (non TS_VADDR, che va nei batch), aspettando che le altre lo abbiano fatto
+static void tlb_shootdown_one(int op, struct addrspace *as, vaddr_t start, vaddr_t end)
+{
+    struct tlb_batch b;
+    unsigned me;
+    int spl;
+
+    tlb_batch_init(&b);
+
+    spl = splhigh();
+    me = curcpu->c_number;
+    tlb_do_shootdown(op, as, start, end);
+    spinlock_acquire(&asid_lock);
+    b.cpus = as->tlb_cpumask & ~((uint32_t)1 << me);
+    spinlock_release(&asid_lock);
+    splx(spl);
+
+    b.ts[0].ts_op = op;
+    b.ts[0].ts_as = as;
+    b.ts[0].ts_vaddr = start;
+    b.ts[0].ts_end = end;
+    b.n = 1;
+    tlb_shootdown_send(&b);
+}
+
+//Le pagine di as sono cambiate tutte (as_copy le rende copy-on-write): nessuna TLB deve averne ancora le traduzioni
+void tlb_invalid_as(struct addrspace *as)
+{
+    tlb_shootdown_one(TS_AS, as, 0, 0);
+}
+
+//Le pagine di as in [start, end) non sono più valide (riduzione dell'heap): una sola ricerca per CPU, non una per pagina
+void tlb_invalid_range(struct addrspace *as, vaddr_t start, vaddr_t end)
+{
+    tlb_shootdown_one(TS_RANGE, as, start, end);
+}
+
+//as sta per essere distrutto (as_destroy): le sue entry spariscono da tutte le TLB e il suo ASID non viene più usato
+void tlb_forget(struct addrspace *as)
+{
+    tlb_shootdown_one(TS_FORGET, as, 0, 0);
+}
+
+void tlb_batch_init(struct tlb_batch *b)
+{
+    b->n = 0;
+    b->cpus = 0;
+    b->pending = 0;
+}
+
+/*
+ * Aggiunge al batch la traduzione vaddr di as. Sulla CPU corrente viene invalidata subito; le altre CPU sono
+ * destinatarie solo se la loro TLB può contenere entry di as. Può essere chiamata con spinlock presi.
+ */
+void tlb_shootdown_add(struct tlb_batch *b, struct addrspace *as, vaddr_t vaddr)
+{
+    unsigned me;
+    uint32_t cpus;
+    int spl;
+
+    spl = splhigh();
+    me = curcpu->c_number;
+    tlb_do_shootdown(TS_VADDR, as, vaddr, 0);
+    spinlock_acquire(&asid_lock);
+    cpus = as->tlb_cpumask & ~((uint32_t)1 << me);
+    spinlock_release(&asid_lock);
+    splx(spl);
+
+    if (cpus == 0)
+    {
+        return;
+    }
+    b->cpus |= cpus;
+
+    if (b->n == 1 && b->ts[0].ts_op == TS_ALL)
+    {
+        return; //il batch svuota già tutta la TLB
+    }
+    if (b->n == TLBSHOOTDOWN_MAX)
+    {
+        b->ts[0].ts_op = TS_ALL;
+        b->ts[0].ts_as = NULL;
+        b->ts[0].ts_vaddr = 0;
+        b->ts[0].ts_end = 0;
+        b->n = 1;
+        return;
+    }
+    b->ts[b->n].ts_op = TS_VADDR;
+    b->ts[b->n].ts_as = as;
+    b->ts[b->n].ts_vaddr = vaddr;
+    b->ts[b->n].ts_end = vaddr + PAGE_SIZE;
+    b->n++;
+}
+
+/*
+ * Spedisce il batch con un IPI per CPU di destinazione e aspetta che tutte lo abbiano eseguito: al ritorno nessuna
+ * TLB contiene più le traduzioni del batch. Va chiamata senza spinlock e con gli interrupt abilitati, così gli
+ * shootdown diretti a questa CPU vengono eseguiti anche durante l'attesa.
+ */
+void tlb_shootdown_send(struct tlb_batch *b)
+{
+    unsigned i, ntargets;
+
+    if (b->cpus == 0)
+    {
+        return;
+    }
+    KASSERT(curcpu->c_spinlocks == 0);
+
+    ntargets = 0;
+    for (i = 0; i < TLB_MAXCPUS; i++)
+    {
+        if (b->cpus & ((uint32_t)1 << i))
+        {
+            ntargets++;
+        }
+    }
+    for (i = 0; i < b->n; i++)
+    {
+        b->ts[i].ts_pending = &b->pending;
+    }
+    b->pending = ntargets * b->n;
+
+    for (i = 0; i < TLB_MAXCPUS; i++)
+    {
+        if (b->cpus & ((uint32_t)1 << i))
+        {
+            ipi_tlbshootdown_batch(tlb_cpus[i].cpu, b->ts, b->n);
+            vmstats_increment(TLB_SHOOTDOWNS);
+        }
+    }
+
+    while (b->pending > 0)
+    {
+        //attesa attiva: le CPU di destinazione eseguono lo shootdown nell'interrupt
+    }
+}
+
+//Esegue uno shootdown ricevuto da un'altra CPU (vm_tlbshootdown, nell'interrupt)
+void tlb_shootdown_handle(const struct tlbshootdown *ts)
+{
+    int n;
+
+    n = tlb_do_shootdown(ts->ts_op, ts->ts_as, ts->ts_vaddr, ts->ts_end);
+    if (n > 0)
+    {
+        vmstats_add(TLB_SHOOTDOWN_ENTRIES, n);
+    }
+
+    spinlock_acquire(&tlb_ack_lock);
+    (*ts->ts_pending)--;
+    spinlock_release(&tlb_ack_lock);
+}
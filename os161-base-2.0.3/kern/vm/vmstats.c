@@ -1,19 +1,23 @@
 #include <vmstats.h>
 #include <spinlock.h>
 #include <lib.h>
+#include <spl.h>
+#include <cpu.h>
+#include <current.h>
+#include <vm.h>
+#include <clock.h>
+#include <membar.h>
 
 
 static struct spinlock vmstats_lock = SPINLOCK_INITIALIZER;
 static struct statistics* vmstats = NULL;
 static int vmstats_active = 0;
+static volatile unsigned vmlat_gen = 0; //generazione degli istogrammi, incrementata da vmlat_reset
 
+//Cambia solo all'avvio e allo spegnimento: si legge senza lock, come isCoremapActive
 static int vmstats_isactive(void)
 {
-    int active;
-	spinlock_acquire(&vmstats_lock);
-	active = vmstats_active;
-	spinlock_release(&vmstats_lock);
-	return active;
+    return vmstats_active;
 }
 
 void vmstats_init(void)
@@ -24,16 +28,14 @@ void vmstats_init(void)
         panic("Failed stats initialization\n");
     }
 
-    vmstats->tlb_faults = 0;
-    vmstats->tlb_faults_with_free = 0;
-    vmstats->tlb_faults_with_replace = 0;
-    vmstats->tlb_invalidations = 0;
-    vmstats->tlb_reloads = 0;
-    vmstats->page_faults_zeroed = 0;
-    vmstats->page_faults_disk = 0;
-    vmstats->page_faults_elf = 0;
-    vmstats->page_faults_swap = 0;
-    vmstats->swapfile_writes = 0;
+    vmstats->as_destroys = 0;
+    vmstats->as_destroy_ns = 0;
+    vmstats->as_destroy_ns_max = 0;
+    vmstats->evictions = 0;
+    vmstats->evict_ns = 0;
+    vmstats->evict_ns_max = 0;
+    vmstats->shared_frames_peak = 0;
+    vmstats->shared_pages_peak = 0;
 
     spinlock_acquire(&vmstats_lock);
     vmstats_active = 1;
@@ -43,25 +45,55 @@ void vmstats_init(void)
 
 void vmstats_shutdown(void)
 {
+    unsigned int c[VMSTATS_NUM];
+
     //stampo le statistiche 
+    vmstats_get(c);
+
+    kprintf("tlb_faults = %d\n", c[TLB_FAULTS]);
+    kprintf("tlb_faults_with_free = %d\n", c[TLB_FAULTS_WITH_FREE]);
+    kprintf("tlb_faults with replace = %d\n", c[TLB_FAULTS_WITH_REPLACE]);
+    kprintf("tlb_invalidation = %d\n", c[TLB_INVALIDATIONS]);
+    kprintf("tlb_reloads = %d\n", c[TLB_RELOADS]);
+    kprintf("page fault zeroed = %d\n", c[PAGE_FAULTS_ZEROED]);
+    kprintf("page fault zeroed in advance = %d (%d%% of zero-fill faults)\n", c[PAGE_FAULTS_PREZEROED],
+        c[PAGE_FAULTS_ZEROED] ? c[PAGE_FAULTS_PREZEROED] * 100 / c[PAGE_FAULTS_ZEROED] : 0);
+    kprintf("page fault disk = %d\n", c[PAGE_FAULTS_DISK]);
+    kprintf("page fault elf = %d\n", c[PAGE_FAULTS_ELF]);
+    kprintf("page fault swap = %d\n", c[PAGE_FAULTS_SWAP]);
+    kprintf("swapfile writes = %d\n", c[SWAPFILE_WRITES]);
+    kprintf("tlb preloads = %d\n", c[TLB_PRELOADS]);
+    kprintf("tlb preloads used = %d\n", c[TLB_PRELOADS_USED]);
+    kprintf("pages prefaulted = %d\n", c[PAGES_PREFAULTED]);
+    kprintf("page cache hits = %d\n", c[PAGECACHE_HITS]);
+    kprintf("cow faults = %d\n", c[COW_FAULTS]);
+    kprintf("cow copies = %d\n", c[COW_COPIES]);
+    kprintf("swapped pages forked without I/O = %d\n", c[SWAP_FORK_SHARED]);
+    kprintf("tlb shootdowns = %d, entries invalidated = %d (%d.%02d per shootdown)\n", c[TLB_SHOOTDOWNS],
+        c[TLB_SHOOTDOWN_ENTRIES],
+        c[TLB_SHOOTDOWNS] ? c[TLB_SHOOTDOWN_ENTRIES] / c[TLB_SHOOTDOWNS] : 0,
+        c[TLB_SHOOTDOWNS] ? c[TLB_SHOOTDOWN_ENTRIES] * 100 / c[TLB_SHOOTDOWNS] % 100 : 0);
+    kprintf("asid rollovers = %d\n", c[ASID_ROLLOVERS]);
+    kprintf("software tlb hits = %d (%d%% of tlb faults, %d%% of tlb reloads)\n", c[STLB_HITS],
+        c[TLB_FAULTS] ? c[STLB_HITS] * 100 / c[TLB_FAULTS] : 0,
+        c[TLB_RELOADS] ? c[STLB_HITS] * 100 / c[TLB_RELOADS] : 0);
+    kprintf("shared frames (peak) = %d\n", vmstats->shared_frames_peak);
+    kprintf("memory saved by sharing (peak) = %d KB\n", vmstats->shared_pages_peak * PAGE_SIZE / 1024);
+    kprintf("as_destroy = %d, average %llu us, max %llu us\n", vmstats->as_destroys,
+        (unsigned long long)(vmstats->as_destroys ? vmstats->as_destroy_ns / vmstats->as_destroys / 1000 : 0),
+        (unsigned long long)(vmstats->as_destroy_ns_max / 1000));
+    kprintf("victims picked = %d, average %llu ns, max %llu ns (without swap I/O)\n", vmstats->evictions,
+        (unsigned long long)(vmstats->evictions ? vmstats->evict_ns / vmstats->evictions : 0),
+        (unsigned long long)vmstats->evict_ns_max);
 
-    kprintf("tlb_faults = %d\n", vmstats->tlb_faults);
-    kprintf("tlb_faults_with_free = %d\n", vmstats->tlb_faults_with_free);
-    kprintf("tlb_faults with replace = %d\n", vmstats->tlb_faults_with_replace);
-    kprintf("tlb_invalidation = %d\n", vmstats->tlb_invalidations);
-    kprintf("tlb_reloads = %d\n", vmstats->tlb_reloads);
-    kprintf("page fault zeroed = %d\n", vmstats->page_faults_zeroed);
-    kprintf("page fault disk = %d\n", vmstats->page_faults_disk);
-    kprintf("page fault elf = %d\n", vmstats->page_faults_elf);
-    kprintf("page fault swap = %d\n", vmstats->page_faults_swap);
-    kprintf("swapfile writes = %d\n", vmstats->swapfile_writes);
+    vmlat_print();
 
-    if(vmstats->tlb_faults != vmstats->tlb_faults_with_free + vmstats->tlb_faults_with_replace)
+    if(c[TLB_FAULTS] != c[TLB_FAULTS_WITH_FREE] + c[TLB_FAULTS_WITH_REPLACE])
     {
         kprintf("WARNING: Il conteggio di tlb faults non è coerente con tlb faults with free e tlb fault with replacement");
     }
 
-    if(vmstats->tlb_faults != vmstats->tlb_reloads + vmstats->page_faults_zeroed + vmstats->page_faults_disk)
+    if(c[TLB_FAULTS] != c[TLB_RELOADS] + c[PAGE_FAULTS_ZEROED] + c[PAGE_FAULTS_DISK])
     {
         kprintf("WARNING: Il conteggio di tlb faults non è coerente con tlb reloads, page fault zeroed e page fault disk");
 
@@ -75,53 +107,288 @@ void vmstats_shutdown(void)
 	kfree(vmstats);
 }
 
+//Incrementa il contatore code della CPU corrente
 void vmstats_increment(int code)
+{
+    vmstats_add(code, 1);
+}
+
+//Somma n al contatore code della CPU corrente: niente lock, solo interrupt disabilitati perché il thread non
+//cambi CPU (e nessun interrupt aggiorni lo stesso contatore) durante l'aggiornamento
+void vmstats_add(int code, unsigned n)
+{
+    int spl;
+
+    if(!vmstats_isactive())
+    {
+        return;
+    }
+
+    if(code < 0 || code >= VMSTATS_NUM)
+    {
+        panic("Statistic code not recognized\n");
+    }
+
+    spl = splhigh();
+    curcpu->c_vmstats[code] += n;
+    splx(spl);
+}
+
+//Somma i contatori di tutte le CPU in counters (VMSTATS_NUM elementi). Le CPU continuano ad aggiornarli: la somma
+//non è una fotografia istantanea, ma ogni contatore è letto intero
+void vmstats_get(unsigned int *counters)
+{
+    unsigned i, n;
+    int code;
+    struct cpu *c;
+
+    for(code = 0; code < VMSTATS_NUM; code++)
+    {
+        counters[code] = 0;
+    }
+
+    n = cpu_count();
+    for(i = 0; i < n; i++)
+    {
+        c = cpu_get(i);
+        for(code = 0; code < VMSTATS_NUM; code++)
+        {
+            counters[code] += c->c_vmstats[code];
+        }
+    }
+}
+
+//Aggiorna i massimi dei frame condivisi e delle pagine risparmiate, dati i valori correnti
+void vmstats_shared(int frames, int pages)
 {
     if(!vmstats_isactive())
     {
         return;
     }
 
+    spinlock_acquire(&vmstats_lock);
+    if((unsigned int)frames > vmstats->shared_frames_peak)
+    {
+        vmstats->shared_frames_peak = frames;
+    }
+    if((unsigned int)pages > vmstats->shared_pages_peak)
+    {
+        vmstats->shared_pages_peak = pages;
+    }
+    spinlock_release(&vmstats_lock);
+}
+
+//Registra la durata di un as_destroy (latenza di uscita di un processo)
+void vmstats_teardown(uint64_t ns)
+{
+    if(!vmstats_isactive())
+    {
+        return;
+    }
 
     spinlock_acquire(&vmstats_lock);
-    
-    switch (code)
-    {
-    case TLB_FAULTS:
-        vmstats->tlb_faults += 1;
-        break;
-    case TLB_FAULTS_WITH_FREE:
-        vmstats->tlb_faults_with_free += 1;
-        break;
-    case TLB_FAULTS_WITH_REPLACE:
-        vmstats->tlb_faults_with_replace += 1;
-        break;
-    case TLB_INVALIDATIONS:
-        vmstats->tlb_invalidations += 1;
-        break;
-    case TLB_RELOADS:
-        vmstats->tlb_reloads += 1;
-        break;
-    case PAGE_FAULTS_ZEROED:
-        vmstats->page_faults_zeroed += 1;
-        break;
-    case PAGE_FAULTS_DISK:
-        vmstats->page_faults_disk += 1;
-        break;
-    case PAGE_FAULTS_ELF:
-        vmstats->page_faults_elf += 1;
-        break;
-    case PAGE_FAULTS_SWAP:
-        vmstats->page_faults_swap += 1;
-        break;
-    case SWAPFILE_WRITES:
-        vmstats->swapfile_writes += 1;
-        break;
-    default:
-        panic("Statistic code not recognized\n");
-        break;
+    vmstats->as_destroys += 1;
+    vmstats->as_destroy_ns += ns;
+    if(ns > vmstats->as_destroy_ns_max)
+    {
+        vmstats->as_destroy_ns_max = ns;
+    }
+    spinlock_release(&vmstats_lock);
+}
+
+//Registra la durata della scelta di una vittima, compresa l'invalidazione nelle TLB (shootdown)
+void vmstats_evict(uint64_t ns)
+{
+    if(!vmstats_isactive())
+    {
+        return;
     }
 
+    spinlock_acquire(&vmstats_lock);
+    vmstats->evictions += 1;
+    vmstats->evict_ns += ns;
+    if(ns > vmstats->evict_ns_max)
+    {
+        vmstats->evict_ns_max = ns;
+    }
     spinlock_release(&vmstats_lock);
+}
+
+//Istante di inizio di un evento da misurare con vmlat_record, 0 se le statistiche non sono attive
+uint64_t vmlat_start(void)
+{
+    struct timespec ts;
+
+    if(!vmstats_isactive())
+    {
+        return 0;
+    }
+
+    gettime(&ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+//Conta nell'istogramma code della CPU corrente la durata dell'evento iniziato a start (vmlat_start)
+void vmlat_record(int code, uint64_t start)
+{
+    struct timespec ts;
+    uint64_t ns;
+    uint32_t d;
+    int bucket, spl;
+
+    if(start == 0 || !vmstats_isactive())
+    {
+        return;
+    }
+
+    if(code < 0 || code >= VMLAT_NUM)
+    {
+        panic("Latency histogram code not recognized\n");
+    }
+
+    gettime(&ts);
+    ns = ts.tv_sec * 1000000000ULL + ts.tv_nsec - start;
+
+    //bucket = log2(ns): oltre 2^32 ns (4 s) l'evento finisce comunque nell'ultimo
+    bucket = VMLAT_BUCKETS - 1;
+    if(ns >> 32 == 0)
+    {
+        d = ns;
+        for(bucket = 0; d > 1 && bucket < VMLAT_BUCKETS - 1; bucket++)
+        {
+            d >>= 1;
+        }
+    }
+
+    spl = splhigh();
+    curcpu->c_vmlat_seq++;
+    membar_store_store();
+    if(curcpu->c_vmlat_gen != vmlat_gen)
+    {
+        //c'è stato un vmlat_reset: gli istogrammi li azzera solo la CPU proprietaria, dentro la sequenza
+        bzero(curcpu->c_vmlat, sizeof(curcpu->c_vmlat));
+        bzero(curcpu->c_vmlat_ns, sizeof(curcpu->c_vmlat_ns));
+        curcpu->c_vmlat_gen = vmlat_gen;
+    }
+    curcpu->c_vmlat[code][bucket] += 1;
+    curcpu->c_vmlat_ns[code] += ns;
+    membar_store_store();
+    curcpu->c_vmlat_seq++;
+    splx(spl);
+}
+
+//Legge l'istogramma code della CPU c (se h != NULL) e il suo totale. Su MIPS a 32 bit il totale è di due parole:
+//si rilegge finché nessun aggiornamento della CPU proprietaria si è sovrapposto alla lettura (c_vmlat_seq
+//dispari o cambiato). Una CPU che non ha ancora visto l'ultimo vmlat_reset conta come azzerata
+static uint64_t vmlat_read(struct cpu *c, int code, unsigned *h)
+{
+    unsigned seq;
+    uint64_t ns;
+    int b, current;
+
+    do
+    {
+        seq = c->c_vmlat_seq;
+        membar_load_load();
+        current = c->c_vmlat_gen == vmlat_gen;
+        ns = current ? c->c_vmlat_ns[code] : 0;
+        for(b = 0; h != NULL && b < VMLAT_BUCKETS; b++)
+        {
+            h[b] = current ? c->c_vmlat[code][b] : 0;
+        }
+        membar_load_load();
+    } while((seq & 1) || seq != c->c_vmlat_seq);
+
+    return ns;
+}
+
+//Tempo totale (ns) speso negli eventi code, sommato su tutte le CPU (usato dal controllo del carico, loadctl.c)
+uint64_t vmlat_ns(int code)
+{
+    unsigned i, n;
+    uint64_t ns = 0;
+
+    KASSERT(code >= 0 && code < VMLAT_NUM);
+    n = cpu_count();
+    for(i = 0; i < n; i++)
+    {
+        ns += vmlat_read(cpu_get(i), code, NULL);
+    }
+    return ns;
+}
+
+//Azzera gli istogrammi di tutte le CPU (comando vmlat del menu). Gli eventi in corso vengono contati nei nuovi.
+//Le altre CPU non vengono toccate: ognuna azzera i propri al prossimo vmlat_record (vedi c_vmlat_gen)
+void vmlat_reset(void)
+{
+    vmlat_gen++;
+}
+
+//Stampa gli istogrammi delle latenze, sommati su tutte le CPU. Ogni riga è il limite inferiore del bucket
+void vmlat_print(void)
+{
+    static const char *names[VMLAT_NUM] = {
+        "vm_fault reload", "vm_fault zeroed", "vm_fault elf", "vm_fault swap", "vm_fault cow",
+        "swapin", "swapout", "getppage_user",
+    };
+    unsigned h[VMLAT_BUCKETS], ch[VMLAT_BUCKETS];
+    unsigned i, n, count, max;
+    uint64_t ns;
+    struct cpu *c;
+    int code, b, j, first, last;
 
-}
\ No newline at end of file
+    n = cpu_count();
+    for(code = 0; code < VMLAT_NUM; code++)
+    {
+        bzero(h, sizeof(h));
+        ns = 0;
+        for(i = 0; i < n; i++)
+        {
+            c = cpu_get(i);
+            ns += vmlat_read(c, code, ch);
+            for(b = 0; b < VMLAT_BUCKETS; b++)
+            {
+                h[b] += ch[b];
+            }
+        }
+
+        count = 0;
+        max = 0;
+        first = -1;
+        last = -1;
+        for(b = 0; b < VMLAT_BUCKETS; b++)
+        {
+            if(h[b] == 0)
+            {
+                continue;
+            }
+            count += h[b];
+            if(h[b] > max)
+            {
+                max = h[b];
+            }
+            if(first == -1)
+            {
+                first = b;
+            }
+            last = b;
+        }
+
+        if(count == 0)
+        {
+            continue;
+        }
+
+        kprintf("%s latency: %u events, average %llu ns\n", names[code], count,
+            (unsigned long long)(ns / count));
+        for(b = first; b <= last; b++)
+        {
+            kprintf("  %10u ns %8u ", 1U << b, h[b]);
+            for(j = 0; j < (int)((h[b] * 40ULL + max - 1) / max); j++)
+            {
+                kprintf("*");
+            }
+            kprintf("\n");
+        }
+    }
+}
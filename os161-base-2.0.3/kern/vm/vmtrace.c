@@ -0,0 +1,211 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <lib.h>
+#include <spl.h>
+#include <cpu.h>
+#include <current.h>
+#include <proc.h>
+#include <clock.h>
+#include <uio.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <vmtrace.h>
+#include "opt-waitpid.h"
+
+/*
+ * Un buffer circolare per CPU, allocato alla prima attivazione e mai liberato. Ogni CPU scrive solo nel proprio,
+ * a splhigh e senza lock; head conta tutti i record scritti, quindi head - VMTRACE_RECS sono stati sovrascritti.
+ */
+struct vmtrace_ring {
+    unsigned head;
+    struct vmtrace_record recs[VMTRACE_RECS];
+};
+
+static struct vmtrace_ring *vmtrace_rings[VMTRACE_MAXCPUS];
+
+int vmtrace_enabled = 0;
+
+//Registra un evento nel buffer della CPU corrente. Chiamata solo attraverso VMTRACE, a traccia attiva
+void vmtrace_log(int event, struct addrspace *as, vaddr_t vaddr, paddr_t paddr, int slot)
+{
+    struct vmtrace_ring *ring;
+    struct vmtrace_record *r;
+    struct timespec ts;
+    int spl;
+
+    gettime(&ts);
+
+    spl = splhigh();
+    ring = vmtrace_rings[curcpu->c_number];
+    if (ring == NULL)
+    {
+        //CPU partita dopo l'attivazione della traccia
+        splx(spl);
+        return;
+    }
+
+    r = &ring->recs[ring->head % VMTRACE_RECS];
+    r->vr_sec = ts.tv_sec;
+    r->vr_nsec = ts.tv_nsec;
+    r->vr_event = event;
+    r->vr_cpu = curcpu->c_number;
+    r->vr_unused = 0;
+#if OPT_WAITPID
+    r->vr_pid = (curproc != NULL && curproc != kproc) ? curproc->p_pid : -1;
+#else
+    r->vr_pid = -1;
+#endif
+    r->vr_as = (uint32_t)as;
+    r->vr_vaddr = vaddr;
+    r->vr_paddr = paddr;
+    r->vr_slot = slot;
+    ring->head++;
+    splx(spl);
+}
+
+//Attiva la traccia ripartendo da buffer vuoti
+int vmtrace_start(void)
+{
+    unsigned i, n;
+    int spl;
+
+    n = cpu_count();
+    KASSERT(n <= VMTRACE_MAXCPUS);
+
+    vmtrace_enabled = 0;
+    for (i = 0; i < n; i++)
+    {
+        if (vmtrace_rings[i] == NULL)
+        {
+            vmtrace_rings[i] = kmalloc(sizeof(struct vmtrace_ring));
+            if (vmtrace_rings[i] == NULL)
+            {
+                return ENOMEM;
+            }
+        }
+    }
+
+    spl = splhigh();
+    for (i = 0; i < n; i++)
+    {
+        vmtrace_rings[i]->head = 0;
+    }
+    vmtrace_enabled = 1;
+    splx(spl);
+
+    return 0;
+}
+
+void vmtrace_stop(void)
+{
+    vmtrace_enabled = 0;
+}
+
+static int vmtrace_write(struct vnode *v, off_t *offset, void *buf, size_t len)
+{
+    struct iovec iov;
+    struct uio u;
+    int result;
+
+    uio_kinit(&iov, &u, buf, len, *offset, UIO_WRITE);
+    result = VOP_WRITE(v, &u);
+    if (result)
+    {
+        return result;
+    }
+    if (u.uio_resid != 0)
+    {
+        return ENOSPC;
+    }
+
+    *offset += len;
+    return 0;
+}
+
+/*
+ * Scrive nel file path i record presenti nei buffer, una sequenza per CPU dal più vecchio al più recente. La traccia
+ * viene sospesa durante la scrittura (che altrimenti ne produrrebbe altra) e poi riprende.
+ */
+int vmtrace_dump(const char *path)
+{
+    struct vmtrace_header h;
+    struct vmtrace_ring *ring;
+    struct vnode *v;
+    char *pathbuf;
+    unsigned heads[VMTRACE_MAXCPUS];
+    unsigned i, n, first, count, len;
+    off_t offset;
+    int enabled, result;
+
+    enabled = vmtrace_enabled;
+    vmtrace_enabled = 0;
+
+    //head letta una volta sola per CPU: l'intestazione deve contare esattamente i record scritti dopo
+    for (i = 0; i < VMTRACE_MAXCPUS; i++)
+    {
+        heads[i] = vmtrace_rings[i] != NULL ? vmtrace_rings[i]->head : 0;
+    }
+
+    h.vh_magic = VMTRACE_MAGIC;
+    h.vh_version = VMTRACE_VERSION;
+    h.vh_recsize = sizeof(struct vmtrace_record);
+    h.vh_nrecords = 0;
+    h.vh_lost = 0;
+    for (i = 0; i < VMTRACE_MAXCPUS; i++)
+    {
+        if (vmtrace_rings[i] != NULL)
+        {
+            count = heads[i];
+            h.vh_nrecords += count < VMTRACE_RECS ? count : VMTRACE_RECS;
+            h.vh_lost += count < VMTRACE_RECS ? 0 : count - VMTRACE_RECS;
+        }
+    }
+
+    pathbuf = kstrdup(path); //vfs_open modifica il nome
+    if (pathbuf == NULL)
+    {
+        vmtrace_enabled = enabled;
+        return ENOMEM;
+    }
+    result = vfs_open(pathbuf, O_WRONLY | O_CREAT | O_TRUNC, 0664, &v);
+    kfree(pathbuf);
+    if (result)
+    {
+        vmtrace_enabled = enabled;
+        return result;
+    }
+
+    offset = 0;
+    result = vmtrace_write(v, &offset, &h, sizeof(h));
+
+    for (i = 0; i < VMTRACE_MAXCPUS && result == 0; i++)
+    {
+        ring = vmtrace_rings[i];
+        if (ring == NULL || heads[i] == 0)
+        {
+            continue;
+        }
+
+        //[first, head) in ordine di tempo: al più due pezzi del buffer circolare
+        count = heads[i] < VMTRACE_RECS ? heads[i] : VMTRACE_RECS;
+        first = (heads[i] - count) % VMTRACE_RECS;
+        n = 0;
+        while (n < count && result == 0)
+        {
+            len = count - n;
+            if (first + len > VMTRACE_RECS)
+            {
+                len = VMTRACE_RECS - first;
+            }
+            result = vmtrace_write(v, &offset, &ring->recs[first], len * sizeof(struct vmtrace_record));
+            n += len;
+            first = (first + len) % VMTRACE_RECS;
+        }
+    }
+
+    vfs_close(v);
+    vmtrace_enabled = enabled;
+
+    return result;
+}
@@ -112,6 +112,7 @@
 __DEAD void _exit(int code);
 int execv(const char *prog, char *const *args);
 pid_t fork(void);
+pid_t vfork(void);
 pid_t waitpid(pid_t pid, int *returncode, int flags);
 /*
  * Open actually takes either two or three args: the optional third
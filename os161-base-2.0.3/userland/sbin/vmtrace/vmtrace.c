@@ -0,0 +1,203 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009, 2014
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * vmtrace - decode a VM trace written by the kernel menu command
+ * "vmtrace dump" (format in kern/vmtrace.h).
+ *
+ * Usage: vmtrace [-s] file
+ *
+ * Prints one line per event, in time order (the per-CPU runs of the
+ * file are merged), followed by the number of events of each type.
+ * With -s only the summary is printed.
+ *
+ * Normally run on the host as hostbin/host-vmtrace on the file the
+ * kernel wrote through emu0. The file is big-endian; the fields are
+ * decoded byte by byte so the same code works on either byte order.
+ */
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <err.h>
+
+#include "kern/vmtrace.h"
+
+#define HEADERSIZE 20	/* struct vmtrace_header on disk */
+#define RECSIZE    32	/* struct vmtrace_record on disk */
+
+struct rec {
+	uint32_t sec, nsec;
+	unsigned event, cpu;
+	int32_t pid;
+	uint32_t as, vaddr, paddr;
+	int32_t slot;
+};
+
+static const char *const eventnames[] = {
+	"?", "reload", "zero", "elf", "swapin", "cow", "evict",
+};
+#define NEVENTS (sizeof(eventnames) / sizeof(eventnames[0]))
+
+static
+uint32_t
+be32(const unsigned char *p)
+{
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+		((uint32_t)p[2] << 8) | p[3];
+}
+
+static
+void
+doread(int fd, void *buf, size_t len, const char *what)
+{
+	ssize_t r;
+	size_t done = 0;
+
+	while (done < len) {
+		r = read(fd, (char *)buf + done, len - done);
+		if (r < 0) {
+			err(1, "read %s", what);
+		}
+		if (r == 0) {
+			errx(1, "%s: unexpected end of file", what);
+		}
+		done += r;
+	}
+}
+
+static
+int
+reccmp(const void *a, const void *b)
+{
+	const struct rec *x = a, *y = b;
+
+	if (x->sec != y->sec) {
+		return x->sec < y->sec ? -1 : 1;
+	}
+	if (x->nsec != y->nsec) {
+		return x->nsec < y->nsec ? -1 : 1;
+	}
+	return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+	unsigned char buf[RECSIZE];
+	unsigned count[NEVENTS];
+	struct rec *recs, *r;
+	uint32_t nrecs, lost, i;
+	const char *file;
+	int fd, summary = 0;
+
+	if (argc == 3 && !strcmp(argv[1], "-s")) {
+		summary = 1;
+		file = argv[2];
+	}
+	else if (argc == 2) {
+		file = argv[1];
+	}
+	else {
+		errx(1, "Usage: vmtrace [-s] file");
+	}
+
+	fd = open(file, O_RDONLY);
+	if (fd < 0) {
+		err(1, "%s", file);
+	}
+
+	doread(fd, buf, HEADERSIZE, "header");
+	if (be32(buf) != VMTRACE_MAGIC) {
+		errx(1, "%s: not a VM trace", file);
+	}
+	if (be32(buf + 4) != VMTRACE_VERSION || be32(buf + 8) != RECSIZE) {
+		errx(1, "%s: unsupported version %u (record size %u)", file,
+		     (unsigned)be32(buf + 4), (unsigned)be32(buf + 8));
+	}
+	nrecs = be32(buf + 12);
+	lost = be32(buf + 16);
+
+	recs = malloc((nrecs ? nrecs : 1) * sizeof(struct rec));
+	if (recs == NULL) {
+		errx(1, "out of memory for %u records", (unsigned)nrecs);
+	}
+
+	for (i=0; i<nrecs; i++) {
+		doread(fd, buf, RECSIZE, "record");
+		r = &recs[i];
+		r->sec = be32(buf);
+		r->nsec = be32(buf + 4);
+		r->event = buf[8];
+		r->cpu = buf[9];
+		r->pid = (int32_t)be32(buf + 12);
+		r->as = be32(buf + 16);
+		r->vaddr = be32(buf + 20);
+		r->paddr = be32(buf + 24);
+		r->slot = (int32_t)be32(buf + 28);
+	}
+	close(fd);
+
+	qsort(recs, nrecs, sizeof(struct rec), reccmp);
+
+	memset(count, 0, sizeof(count));
+	if (!summary) {
+		printf("%-20s %3s %5s %-7s %-10s %-10s %-10s %s\n", "time",
+		       "cpu", "pid", "event", "as", "vaddr", "paddr", "slot");
+	}
+	for (i=0; i<nrecs; i++) {
+		r = &recs[i];
+		count[r->event < NEVENTS ? r->event : 0]++;
+		if (summary) {
+			continue;
+		}
+		printf("%10lu.%09lu %3u %5ld %-7s 0x%08lx 0x%08lx 0x%08lx %ld\n",
+		       (unsigned long)r->sec, (unsigned long)r->nsec, r->cpu,
+		       (long)r->pid,
+		       eventnames[r->event < NEVENTS ? r->event : 0],
+		       (unsigned long)r->as, (unsigned long)r->vaddr,
+		       (unsigned long)r->paddr, (long)r->slot);
+	}
+
+	printf("%lu events (%lu older ones overwritten in the kernel)\n",
+	       (unsigned long)nrecs, (unsigned long)lost);
+	for (i=1; i<NEVENTS; i++) {
+		printf("  %-7s %u\n", eventnames[i], count[i]);
+	}
+	if (count[0] > 0) {
+		printf("  %-7s %u\n", "unknown", count[0]);
+	}
+
+	free(recs);
+	return 0;
+}
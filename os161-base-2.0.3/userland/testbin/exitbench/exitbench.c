@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * exitbench.c
+ *
+ * Exit latency of large processes. For each size, a child dirties
+ * that many pages and exits; the parent reaps it with waitpid, which
+ * is where the child's address space is torn down (proc_destroy ->
+ * as_destroy). The largest size does not fit in RAM, so part of the
+ * child's pages are in the swapfile when it exits.
+ *
+ * There is no IPC to tell the parent when the child starts exiting,
+ * so the program prints the whole fork-to-reap time; the kernel
+ * prints the as_destroy latency alone (average and max) with the VM
+ * statistics at shutdown.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <err.h>
+
+#define PageSize	4096
+#define MaxPages	256	/* 1MB: more than the RAM of the default sys161 */
+#define Rounds		3
+
+static char pages[MaxPages][PageSize];
+
+static const int sizes[] = { 16, 64, MaxPages };
+
+static
+unsigned long
+now_us(void)
+{
+	time_t secs;
+	unsigned long nsecs;
+
+	__time(&secs, &nsecs);
+	return secs * 1000000UL + nsecs / 1000;
+}
+
+int
+main(void)
+{
+	unsigned long start, total;
+	pid_t pid;
+	int i, j, k, status;
+
+	for (i=0; i<(int)(sizeof(sizes)/sizeof(sizes[0])); i++) {
+		total = 0;
+		for (j=0; j<Rounds; j++) {
+			start = now_us();
+			pid = fork();
+			if (pid < 0) {
+				err(1, "fork");
+			}
+			if (pid == 0) {
+				for (k=0; k<sizes[i]; k++) {
+					pages[k][0] = k;
+				}
+				_exit(0);
+			}
+			waitpid(pid, &status, 0);
+			total += now_us() - start;
+		}
+		printf("exitbench: %3d pages: %lu us from fork to reap\n",
+		       sizes[i], total / Rounds);
+	}
+	printf("exitbench: see \"as_destroy\" in the VM statistics "
+	       "for the teardown alone\n");
+
+	return 0;
+}
@@ -0,0 +1,122 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * spawnbench.c
+ *
+ * Process-creation rate: fork+execv versus vfork+execv of a tiny
+ * program (/bin/true), and fork versus vfork followed by an immediate
+ * _exit. Each child is waited for before the next one is created.
+ *
+ * fork duplicates the page table with as_copy (and maps the pages
+ * copy-on-write); vfork lends the parent's address space to the
+ * child until it calls execv or _exit, so it copies nothing.
+ *
+ * Usage: spawnbench [iterations]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <err.h>
+
+#define DEFAULT_ITERS	20
+#define PROG		"/bin/true"
+
+static
+unsigned long
+now_us(void)
+{
+	time_t secs;
+	unsigned long nsecs;
+
+	__time(&secs, &nsecs);
+	return secs * 1000000UL + nsecs / 1000;
+}
+
+/*
+ * Create ITERS children with vfork (if USE_VFORK) or fork. Each child
+ * runs PROG if DOEXEC, otherwise it exits at once. Returns the elapsed
+ * time in microseconds.
+ */
+static
+unsigned long
+run(int iters, int use_vfork, int doexec)
+{
+	char *args[2];
+	unsigned long start;
+	pid_t pid;
+	int i, status;
+
+	args[0] = (char *)PROG;
+	args[1] = NULL;
+
+	start = now_us();
+	for (i=0; i<iters; i++) {
+		pid = use_vfork ? vfork() : fork();
+		if (pid < 0) {
+			err(1, use_vfork ? "vfork" : "fork");
+		}
+		if (pid == 0) {
+			if (doexec) {
+				execv(PROG, args);
+			}
+			_exit(0);
+		}
+		waitpid(pid, &status, 0);
+	}
+	return now_us() - start;
+}
+
+static
+void
+report(const char *what, int iters, unsigned long us)
+{
+	printf("spawnbench: %-13s %lu us/process, %lu processes/s\n",
+	       what, us / iters, us ? iters * 1000000UL / us : 0);
+}
+
+int
+main(int argc, char **argv)
+{
+	int iters;
+
+	iters = (argc > 1) ? atoi(argv[1]) : DEFAULT_ITERS;
+	if (iters <= 0) {
+		errx(1, "Usage: spawnbench [iterations]");
+	}
+
+	printf("spawnbench: %d iterations\n", iters);
+	report("fork+exit", iters, run(iters, 0, 0));
+	report("vfork+exit", iters, run(iters, 1, 0));
+	report("fork+execv", iters, run(iters, 0, 1));
+	report("vfork+execv", iters, run(iters, 1, 1));
+
+	return 0;
+}
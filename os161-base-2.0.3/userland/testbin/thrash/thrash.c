@@ -0,0 +1,119 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * thrash.c
+ *
+ * Runs N copies (default 4) of a memory-hungry program at the same
+ * time, by default /testbin/matmult, and prints how long they took.
+ *
+ * Together their working sets do not fit in RAM: without load control
+ * they keep evicting each other's pages and spend most of the time in
+ * the swap file. Compare the time with "loadctl off" and "loadctl on"
+ * in the kernel menu; with it on, the kernel suspends the largest
+ * process while thrashing and readmits it when the others are done.
+ *
+ * Usage: thrash [copies [program]]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <err.h>
+#include <sys/wait.h>
+
+#define MaxCopies	16
+
+static
+pid_t
+spawnv(const char *prog, char **argv)
+{
+	pid_t pid = fork();
+	switch (pid) {
+	    case -1:
+		err(1, "fork");
+	    case 0:
+		/* child */
+		execv(prog, argv);
+		err(1, "%s: execv", prog);
+	    default:
+		/* parent */
+		break;
+	}
+	return pid;
+}
+
+int
+main(int argc, char **argv)
+{
+	const char *prog = "/testbin/matmult";
+	pid_t pids[MaxCopies];
+	char *args[2];
+	time_t s0, s1;
+	unsigned long ns0, ns1, ms;
+	int copies = 4, i, status, failures = 0;
+
+	if (argc > 1) {
+		copies = atoi(argv[1]);
+	}
+	if (argc > 2) {
+		prog = argv[2];
+	}
+	if (copies < 1 || copies > MaxCopies) {
+		errx(1, "Usage: thrash [copies (1-%d) [program]]", MaxCopies);
+	}
+
+	args[0] = (char *)prog;
+	args[1] = NULL;
+
+	printf("thrash: running %d copies of %s\n", copies, prog);
+	__time(&s0, &ns0);
+
+	for (i=0; i<copies; i++) {
+		pids[i] = spawnv(prog, args);
+	}
+
+	for (i=0; i<copies; i++) {
+		if (waitpid(pids[i], &status, 0) < 0) {
+			warn("waitpid for copy #%d (pid %d)", i, pids[i]);
+			failures++;
+		}
+		else if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			warnx("copy #%d (pid %d) failed", i, pids[i]);
+			failures++;
+		}
+	}
+
+	__time(&s1, &ns1);
+	ms = (s1 - s0) * 1000 + (ns1 / 1000000) - (ns0 / 1000000);
+
+	printf("thrash: %d copies done in %lu.%03lu s, %d failures\n",
+	       copies, ms / 1000, ms % 1000, failures);
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,135 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * tlbreload.c
+ *
+ * Measures the cost of a TLB-reload fault (TLB_RELOADS), that is a
+ * TLB miss on a page that is already resident.
+ *
+ * The program touches NumPages pages once to bring them in memory,
+ * then sweeps them cyclically. Since NumPages is larger than the 64
+ * TLB entries, every access of the sweep misses in the TLB but never
+ * needs a page fault. NumPages is kept small enough to fit in RAM,
+ * otherwise the sweep would measure swapping instead.
+ *
+ * The same run with a sweep over a few pages (that always hit in the
+ * TLB) gives the baseline to subtract.
+ *
+ * Not every miss is a fault: fault-around loads the neighbouring
+ * pages together with the faulting one, and the kernel keeps a
+ * software TLB behind the hardware one, so only a fraction of the
+ * accesses trap. The extra time is therefore divided by the minor
+ * faults counted by getrusage during the sweep, not by the accesses.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <err.h>
+#include <sys/resource.h>
+
+#define PageSize	4096
+#define NumPages	72	/* more than NUM_TLB, less than free RAM */
+#define HitPages	8	/* always fits in the TLB */
+#define Sweeps		50
+
+static char pages[NumPages][PageSize];
+
+/*
+ * Sweep the first NPAGES pages SWEEPS times and return the elapsed
+ * time in nanoseconds.
+ */
+static
+unsigned long
+sweep(int npages, int sweeps)
+{
+	time_t secs0, secs1;
+	unsigned long nsecs0, nsecs1;
+	int i, j;
+
+	__time(&secs0, &nsecs0);
+	for (j=0; j<sweeps; j++) {
+		for (i=0; i<npages; i++) {
+			pages[i][0]++;
+		}
+	}
+	__time(&secs1, &nsecs1);
+
+	return (secs1 - secs0) * 1000000000UL + nsecs1 - nsecs0;
+}
+
+int
+main(void)
+{
+	struct rusage before, after;
+	unsigned long hit, miss, hitper, missper, faults, extra;
+	int i;
+
+	printf("tlbreload: %d pages, %d sweeps\n", NumPages, Sweeps);
+
+	/* Fault every page in, so the sweeps only cause TLB reloads. */
+	for (i=0; i<NumPages; i++) {
+		pages[i][0] = 0;
+	}
+
+	/*
+	 * Scale the hit sweep so both loops make the same number of
+	 * accesses.
+	 */
+	hit = sweep(HitPages, Sweeps * (NumPages / HitPages));
+
+	if (getrusage(RUSAGE_SELF, &before)) {
+		err(1, "getrusage");
+	}
+	miss = sweep(NumPages, Sweeps);
+	if (getrusage(RUSAGE_SELF, &after)) {
+		err(1, "getrusage");
+	}
+	faults = after.ru_minflt - before.ru_minflt;
+
+	hitper = hit / (Sweeps * (NumPages / HitPages) * HitPages);
+	missper = miss / (Sweeps * NumPages);
+
+	/* Time spent in the sweep beyond what the same accesses cost on a TLB hit. */
+	extra = hitper * (Sweeps * NumPages);
+	extra = miss > extra ? miss - extra : 0;
+
+	printf("tlbreload: TLB hit access:    %lu ns\n", hitper);
+	printf("tlbreload: TLB sweep access:  %lu ns\n", missper);
+	printf("tlbreload: reload faults:     %lu (%d accesses)\n",
+	       faults, Sweeps * NumPages);
+	if (faults == 0) {
+		errx(1, "no reload faults during the sweep");
+	}
+	printf("tlbreload: cost of one reload fault: %lu ns\n",
+	       extra / faults);
+
+	return 0;
+}
@@ -0,0 +1,104 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * vmusage.c
+ *
+ * Checks the VM counters returned by getrusage(RUSAGE_SELF).
+ *
+ * The program grows its heap by NumPages pages, touches them and reads
+ * its usage before and after: every heap page is zero-filled on its
+ * first access, which is a minor fault, and becomes resident. Run it together with "vmtop" from the
+ * kernel menu to compare with the per-process table.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <err.h>
+#include <sys/resource.h>
+
+#define PageSize	4096
+#define NumPages	32	/* well below free RAM: no swapping */
+
+static
+void
+show(const char *when, struct rusage *ru)
+{
+	printf("vmusage: %s: minflt %lu majflt %lu resident %luk "
+	       "swapped %luk maxrss %luk swapouts %lu\n", when,
+	       (unsigned long)ru->ru_minflt, (unsigned long)ru->ru_majflt,
+	       (unsigned long)ru->ru_idrss, (unsigned long)ru->ru_isrss,
+	       (unsigned long)ru->ru_maxrss, (unsigned long)ru->ru_nswap);
+}
+
+int
+main(void)
+{
+	struct rusage before, after;
+	char *pages;
+	int i;
+
+	if (getrusage(RUSAGE_CHILDREN, &before) != -1 || errno != EINVAL) {
+		errx(1, "getrusage(RUSAGE_CHILDREN) should fail with EINVAL");
+	}
+
+	pages = sbrk(NumPages * PageSize);
+	if (pages == (void *)-1) {
+		err(1, "sbrk");
+	}
+
+	if (getrusage(RUSAGE_SELF, &before)) {
+		err(1, "getrusage");
+	}
+	show("before", &before);
+
+	for (i=0; i<NumPages; i++) {
+		pages[i * PageSize] = 1;
+	}
+
+	if (getrusage(RUSAGE_SELF, &after)) {
+		err(1, "getrusage");
+	}
+	show("after", &after);
+
+	if (after.ru_minflt - before.ru_minflt < NumPages) {
+		errx(1, "expected at least %d more minor faults", NumPages);
+	}
+	if (after.ru_idrss - before.ru_idrss < NumPages * (PageSize / 1024)) {
+		errx(1, "expected at least %d more resident pages", NumPages);
+	}
+	if (after.ru_maxrss < after.ru_idrss) {
+		errx(1, "maxrss below the resident size");
+	}
+
+	printf("vmusage: passed\n");
+	return 0;
+}